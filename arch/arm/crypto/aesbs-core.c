@@ -0,0 +1,672 @@
+/*
+ * Bit sliced AES using NEON instructions
+ *
+ * Eight blocks are processed in parallel: the state of the batch is
+ * transposed into eight 128-bit words, word i holding bit i of every byte of
+ * every block, so that SubBytes becomes a fixed sequence of logical
+ * operations (the Boyar-Peralta circuit) and ShiftRows/MixColumns become
+ * shifts and rotations. This runs in constant time and keeps all NEON lanes
+ * busy, which the table based scalar code in aes-armv4.S cannot do.
+ *
+ * Each 128-bit word is handled as two 64-bit lanes of four blocks each,
+ * using the same layout as the 64-bit constant time AES in BearSSL.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+
+#include "aesbs.h"
+
+#ifndef __ARM_NEON__
+#error You should compile this file with '-mfloat-abi=softfp -mfpu=neon'
+#endif
+
+typedef u64 bs_word __attribute__((vector_size(16)));
+
+union bs_lanes {
+	bs_word	v;
+	u64	l[2];
+};
+
+#define BS_C(c)		((bs_word){ (c), (c) })
+
+static inline void sbox(bs_word *q)
+{
+	/*
+	 * Boyar and Peralta, "A new combinational logic minimization
+	 * technique with applications to cryptology". x0 is the most
+	 * significant input bit, s0 the most significant output bit.
+	 */
+	bs_word x0, x1, x2, x3, x4, x5, x6, x7;
+	bs_word y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	bs_word y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	bs_word y20, y21;
+	bs_word z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	bs_word z10, z11, z12, z13, z14, z15, z16, z17;
+	bs_word t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	bs_word t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	bs_word t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	bs_word t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	bs_word t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	bs_word t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	bs_word t60, t61, t62, t63, t64, t65, t66, t67;
+	bs_word s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/* the affine transformation of the S-box is its own inverse up to a shift */
+static inline void inv_affine(bs_word *q)
+{
+	bs_word q0, q1, q2, q3, q4, q5, q6, q7;
+
+	q0 = ~q[0];
+	q1 = ~q[1];
+	q2 = q[2];
+	q3 = q[3];
+	q4 = q[4];
+	q5 = ~q[5];
+	q6 = ~q[6];
+	q7 = q[7];
+	q[7] = q1 ^ q4 ^ q6;
+	q[6] = q0 ^ q3 ^ q5;
+	q[5] = q7 ^ q2 ^ q4;
+	q[4] = q6 ^ q1 ^ q3;
+	q[3] = q5 ^ q0 ^ q2;
+	q[2] = q4 ^ q7 ^ q1;
+	q[1] = q3 ^ q6 ^ q0;
+	q[0] = q2 ^ q5 ^ q7;
+}
+
+static inline void inv_sbox(bs_word *q)
+{
+	inv_affine(q);
+	sbox(q);
+	inv_affine(q);
+}
+
+static inline void add_round_key(bs_word *q, const bs_word *rk)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] ^= rk[i];
+}
+
+static inline void shift_rows(bs_word *q)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		bs_word x = q[i];
+
+		q[i] = (x & BS_C(0x000000000000FFFFULL))
+			| ((x & BS_C(0x00000000FFF00000ULL)) >> 4)
+			| ((x & BS_C(0x00000000000F0000ULL)) << 12)
+			| ((x & BS_C(0x0000FF0000000000ULL)) >> 8)
+			| ((x & BS_C(0x000000FF00000000ULL)) << 8)
+			| ((x & BS_C(0xF000000000000000ULL)) >> 12)
+			| ((x & BS_C(0x0FFF000000000000ULL)) << 4);
+	}
+}
+
+static inline void inv_shift_rows(bs_word *q)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		bs_word x = q[i];
+
+		q[i] = (x & BS_C(0x000000000000FFFFULL))
+			| ((x & BS_C(0x000000000FFF0000ULL)) << 4)
+			| ((x & BS_C(0x00000000F0000000ULL)) >> 12)
+			| ((x & BS_C(0x000000FF00000000ULL)) << 8)
+			| ((x & BS_C(0x0000FF0000000000ULL)) >> 8)
+			| ((x & BS_C(0x000F000000000000ULL)) << 12)
+			| ((x & BS_C(0xFFF0000000000000ULL)) >> 4);
+	}
+}
+
+static inline bs_word rotr32(bs_word x)
+{
+	return (x << 32) | (x >> 32);
+}
+
+static inline bs_word rotr16(bs_word x)
+{
+	return (x >> 16) | (x << 48);
+}
+
+static inline void mix_columns(bs_word *q)
+{
+	bs_word q0, q1, q2, q3, q4, q5, q6, q7;
+	bs_word r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0];
+	q1 = q[1];
+	q2 = q[2];
+	q3 = q[3];
+	q4 = q[4];
+	q5 = q[5];
+	q6 = q[6];
+	q7 = q[7];
+	r0 = rotr16(q0);
+	r1 = rotr16(q1);
+	r2 = rotr16(q2);
+	r3 = rotr16(q3);
+	r4 = rotr16(q4);
+	r5 = rotr16(q5);
+	r6 = rotr16(q6);
+	r7 = rotr16(q7);
+
+	q[0] = q7 ^ r7 ^ r0 ^ rotr32(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr32(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ rotr32(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr32(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr32(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ rotr32(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ rotr32(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ rotr32(q7 ^ r7);
+}
+
+static inline void inv_mix_columns(bs_word *q)
+{
+	bs_word q0, q1, q2, q3, q4, q5, q6, q7;
+	bs_word r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0];
+	q1 = q[1];
+	q2 = q[2];
+	q3 = q[3];
+	q4 = q[4];
+	q5 = q[5];
+	q6 = q[6];
+	q7 = q[7];
+	r0 = rotr16(q0);
+	r1 = rotr16(q1);
+	r2 = rotr16(q2);
+	r3 = rotr16(q3);
+	r4 = rotr16(q4);
+	r5 = rotr16(q5);
+	r6 = rotr16(q6);
+	r7 = rotr16(q7);
+
+	q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7
+		^ rotr32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+	q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7
+		^ rotr32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+	q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7
+		^ rotr32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+	q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5
+		^ rotr32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+	q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7
+		^ rotr32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+	q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7
+		^ rotr32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+	q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7
+		^ rotr32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+	q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7
+		^ rotr32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+#define SWAPN(cl, ch, s, x, y) do {					\
+		bs_word a = (x), b = (y);				\
+		(x) = (a & BS_C(cl)) | ((b & BS_C(cl)) << (s));		\
+		(y) = ((a & BS_C(ch)) >> (s)) | (b & BS_C(ch));		\
+	} while (0)
+
+#define SWAP2(x, y)	SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define SWAP4(x, y)	SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define SWAP8(x, y)	SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+/* transpose between byte order and bit sliced order; its own inverse */
+static inline void ortho(bs_word *q)
+{
+	SWAP2(q[0], q[1]);
+	SWAP2(q[2], q[3]);
+	SWAP2(q[4], q[5]);
+	SWAP2(q[6], q[7]);
+
+	SWAP4(q[0], q[2]);
+	SWAP4(q[1], q[3]);
+	SWAP4(q[4], q[6]);
+	SWAP4(q[5], q[7]);
+
+	SWAP8(q[0], q[4]);
+	SWAP8(q[1], q[5]);
+	SWAP8(q[2], q[6]);
+	SWAP8(q[3], q[7]);
+}
+
+/* spread the even and odd bytes of one block over two 64-bit words */
+static void interleave_in(u64 *q0, u64 *q1, const u32 *w)
+{
+	u64 x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+
+	x0 |= x0 << 16;
+	x1 |= x1 << 16;
+	x2 |= x2 << 16;
+	x3 |= x3 << 16;
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	x0 |= x0 << 8;
+	x1 |= x1 << 8;
+	x2 |= x2 << 8;
+	x3 |= x3 << 8;
+	x0 &= 0x00FF00FF00FF00FFULL;
+	x1 &= 0x00FF00FF00FF00FFULL;
+	x2 &= 0x00FF00FF00FF00FFULL;
+	x3 &= 0x00FF00FF00FF00FFULL;
+	*q0 = x0 | (x2 << 8);
+	*q1 = x1 | (x3 << 8);
+}
+
+static void interleave_out(u32 *w, u64 q0, u64 q1)
+{
+	u64 x0, x1, x2, x3;
+
+	x0 = q0 & 0x00FF00FF00FF00FFULL;
+	x1 = q1 & 0x00FF00FF00FF00FFULL;
+	x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+	x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+	x0 |= x0 >> 8;
+	x1 |= x1 >> 8;
+	x2 |= x2 >> 8;
+	x3 |= x3 >> 8;
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	w[0] = (u32)x0 | (u32)(x0 >> 16);
+	w[1] = (u32)x1 | (u32)(x1 >> 16);
+	w[2] = (u32)x2 | (u32)(x2 >> 16);
+	w[3] = (u32)x3 | (u32)(x3 >> 16);
+}
+
+/*
+ * Load up to AESBS_BLOCKS blocks into bit sliced form. Blocks 0-3 go to the
+ * low lane and blocks 4-7 to the high lane; missing blocks are zero.
+ */
+static void load_blocks(bs_word *q, const u8 *in, unsigned int blocks)
+{
+	union bs_lanes lo[8];
+	u32 w[4];
+	int i, j;
+
+	memset(lo, 0, sizeof(lo));
+	for (i = 0; i < blocks; i++) {
+		for (j = 0; j < 4; j++)
+			w[j] = get_unaligned_le32(in + 16 * i + 4 * j);
+		interleave_in(&lo[i & 3].l[i >> 2], &lo[(i & 3) + 4].l[i >> 2],
+			      w);
+	}
+	for (i = 0; i < 8; i++)
+		q[i] = lo[i].v;
+	ortho(q);
+}
+
+static void store_blocks(u8 *out, bs_word *q, unsigned int blocks)
+{
+	union bs_lanes lo[8];
+	u32 w[4];
+	int i, j;
+
+	ortho(q);
+	for (i = 0; i < 8; i++)
+		lo[i].v = q[i];
+	for (i = 0; i < blocks; i++) {
+		interleave_out(w, lo[i & 3].l[i >> 2], lo[(i & 3) + 4].l[i >> 2]);
+		for (j = 0; j < 4; j++)
+			put_unaligned_le32(w[j], out + 16 * i + 4 * j);
+	}
+}
+
+void aesbs_convert_key(struct aesbs_key *key, const u32 *rk, int rounds)
+{
+	bs_word *bk = (bs_word *)key->rk;
+	int i, j;
+
+	for (i = 0; i <= rounds; i++) {
+		bs_word *q = bk + 8 * i;
+		u64 k0, k1;
+
+		interleave_in(&k0, &k1, rk + 4 * i);
+		for (j = 0; j < 4; j++) {
+			q[j] = BS_C(k0);
+			q[j + 4] = BS_C(k1);
+		}
+		ortho(q);
+	}
+	key->rounds = rounds;
+}
+
+static void encrypt_batch(bs_word *q, const struct aesbs_key *key)
+{
+	const bs_word *rk = (const bs_word *)key->rk;
+	int i;
+
+	add_round_key(q, rk);
+	for (i = 1; i < key->rounds; i++) {
+		sbox(q);
+		shift_rows(q);
+		mix_columns(q);
+		add_round_key(q, rk + 8 * i);
+	}
+	sbox(q);
+	shift_rows(q);
+	add_round_key(q, rk + 8 * key->rounds);
+}
+
+static void decrypt_batch(bs_word *q, const struct aesbs_key *key)
+{
+	const bs_word *rk = (const bs_word *)key->rk;
+	int i;
+
+	add_round_key(q, rk + 8 * key->rounds);
+	for (i = key->rounds - 1; i > 0; i--) {
+		inv_shift_rows(q);
+		inv_sbox(q);
+		add_round_key(q, rk + 8 * i);
+		inv_mix_columns(q);
+	}
+	inv_shift_rows(q);
+	inv_sbox(q);
+	add_round_key(q, rk);
+}
+
+void aesbs_ecb_encrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key)
+{
+	bs_word q[8];
+
+	while (blocks) {
+		unsigned int n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		load_blocks(q, in, n);
+		encrypt_batch(q, key);
+		store_blocks(out, q, n);
+		in += 16 * n;
+		out += 16 * n;
+		blocks -= n;
+	}
+}
+
+void aesbs_ecb_decrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key)
+{
+	bs_word q[8];
+
+	while (blocks) {
+		unsigned int n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		load_blocks(q, in, n);
+		decrypt_batch(q, key);
+		store_blocks(out, q, n);
+		in += 16 * n;
+		out += 16 * n;
+		blocks -= n;
+	}
+}
+
+void aesbs_cbc_decrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *iv)
+{
+	u8 buf[AESBS_BLOCKS * 16];
+	bs_word q[8];
+	int i;
+
+	while (blocks) {
+		unsigned int n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		/* keep the ciphertext, in and out may be the same buffer */
+		memcpy(buf, in, 16 * n);
+		load_blocks(q, buf, n);
+		decrypt_batch(q, key);
+		store_blocks(out, q, n);
+		for (i = 0; i < 16; i++)
+			out[i] ^= iv[i];
+		for (i = 16; i < 16 * n; i++)
+			out[i] ^= buf[i - 16];
+		memcpy(iv, buf + 16 * (n - 1), 16);
+		in += 16 * n;
+		out += 16 * n;
+		blocks -= n;
+	}
+}
+
+/* big endian increment of the 128-bit counter block */
+static void ctr_inc(u8 *ctr)
+{
+	int i;
+
+	for (i = 15; i >= 0; i--)
+		if (++ctr[i])
+			break;
+}
+
+void aesbs_ctr_encrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *ctr)
+{
+	u8 ks[AESBS_BLOCKS * 16];
+	bs_word q[8];
+	int i;
+
+	while (blocks) {
+		unsigned int n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		for (i = 0; i < n; i++) {
+			memcpy(ks + 16 * i, ctr, 16);
+			ctr_inc(ctr);
+		}
+		load_blocks(q, ks, n);
+		encrypt_batch(q, key);
+		store_blocks(ks, q, n);
+		for (i = 0; i < 16 * n; i++)
+			out[i] = in[i] ^ ks[i];
+		in += 16 * n;
+		out += 16 * n;
+		blocks -= n;
+	}
+}
+
+/* multiply the tweak by x in GF(2^128), little endian convention */
+static void xts_next_tweak(u8 *t)
+{
+	u64 lo = get_unaligned_le64(t);
+	u64 hi = get_unaligned_le64(t + 8);
+	u64 carry = hi >> 63;
+
+	hi = (hi << 1) | (lo >> 63);
+	lo = (lo << 1) ^ (carry * 0x87);
+	put_unaligned_le64(lo, t);
+	put_unaligned_le64(hi, t + 8);
+}
+
+static void xts_crypt(const u8 *in, u8 *out, unsigned int blocks,
+		      const struct aesbs_key *key, u8 *tweak, int enc)
+{
+	u8 buf[AESBS_BLOCKS * 16];
+	u8 tw[AESBS_BLOCKS * 16];
+	bs_word q[8];
+	int i;
+
+	while (blocks) {
+		unsigned int n = min_t(unsigned int, blocks, AESBS_BLOCKS);
+
+		for (i = 0; i < n; i++) {
+			memcpy(tw + 16 * i, tweak, 16);
+			xts_next_tweak(tweak);
+		}
+		for (i = 0; i < 16 * n; i++)
+			buf[i] = in[i] ^ tw[i];
+		load_blocks(q, buf, n);
+		if (enc)
+			encrypt_batch(q, key);
+		else
+			decrypt_batch(q, key);
+		store_blocks(buf, q, n);
+		for (i = 0; i < 16 * n; i++)
+			out[i] = buf[i] ^ tw[i];
+		in += 16 * n;
+		out += 16 * n;
+		blocks -= n;
+	}
+}
+
+void aesbs_xts_encrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *tweak)
+{
+	xts_crypt(in, out, blocks, key, tweak, 1);
+}
+
+void aesbs_xts_decrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *tweak)
+{
+	xts_crypt(in, out, blocks, key, tweak, 0);
+}
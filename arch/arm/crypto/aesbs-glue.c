@@ -0,0 +1,456 @@
+/*
+ * Glue Code for the NEON bit sliced version of the AES Cipher Algorithm
+ *
+ * The bit sliced core only pays off when eight blocks can be processed at
+ * once, so it is registered for the parallelisable modes only. CBC
+ * encryption is inherently sequential and uses the scalar ARM code. NEON
+ * cannot be used in interrupt context, where the scalar code is used for
+ * every mode, as is done for the NEON xor routines.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <linux/hardirq.h>
+#include <asm/neon.h>
+#include <crypto/aes.h>
+#include <crypto/algapi.h>
+#include <crypto/b128ops.h>
+#include <crypto/gf128mul.h>
+
+#include "aes_glue.h"
+#include "aesbs.h"
+
+struct aesbs_ctx {
+	struct aesbs_key	bs;
+	AES_KEY			enc;
+	AES_KEY			dec;
+};
+
+struct aesbs_xts_ctx {
+	struct aesbs_ctx	crypt;
+	AES_KEY			twkey;
+};
+
+static inline bool aesbs_use_neon(void)
+{
+	return !in_interrupt();
+}
+
+static int aesbs_expand_key(struct aesbs_ctx *ctx, const u8 *in_key,
+			    unsigned int key_len)
+{
+	struct crypto_aes_ctx rk;
+	int err;
+
+	err = crypto_aes_expand_key(&rk, in_key, key_len);
+	if (err)
+		return err;
+
+	kernel_neon_begin();
+	aesbs_convert_key(&ctx->bs, rk.key_enc, 6 + key_len / 4);
+	kernel_neon_end();
+
+	if (private_AES_set_encrypt_key(in_key, key_len * 8, &ctx->enc) == -1)
+		return -EINVAL;
+	/* private_AES_set_decrypt_key expects an encryption key as input */
+	ctx->dec = ctx->enc;
+	if (private_AES_set_decrypt_key(in_key, key_len * 8, &ctx->dec) == -1)
+		return -EINVAL;
+	return 0;
+}
+
+static int aesbs_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+			 unsigned int key_len)
+{
+	struct aesbs_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	if (aesbs_expand_key(ctx, in_key, key_len)) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int aesbs_xts_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+			     unsigned int key_len)
+{
+	struct aesbs_xts_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	/* the first half of the key is the data key, the second the tweak key */
+	if ((key_len % 2) ||
+	    aesbs_expand_key(&ctx->crypt, in_key, key_len / 2) ||
+	    private_AES_set_encrypt_key(in_key + key_len / 2, key_len * 4,
+					&ctx->twkey) == -1) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int ecb_encrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk,
+					AESBS_BLOCKS * AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes)) {
+		unsigned int blocks = nbytes / AES_BLOCK_SIZE;
+		u8 *s = walk.src.virt.addr;
+		u8 *d = walk.dst.virt.addr;
+
+		if (aesbs_use_neon()) {
+			kernel_neon_begin();
+			aesbs_ecb_encrypt(s, d, blocks, &ctx->bs);
+			kernel_neon_end();
+		} else {
+			for (; blocks; blocks--) {
+				AES_encrypt(s, d, &ctx->enc);
+				s += AES_BLOCK_SIZE;
+				d += AES_BLOCK_SIZE;
+			}
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes % AES_BLOCK_SIZE);
+	}
+	return err;
+}
+
+static int ecb_decrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk,
+					AESBS_BLOCKS * AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes)) {
+		unsigned int blocks = nbytes / AES_BLOCK_SIZE;
+		u8 *s = walk.src.virt.addr;
+		u8 *d = walk.dst.virt.addr;
+
+		if (aesbs_use_neon()) {
+			kernel_neon_begin();
+			aesbs_ecb_decrypt(s, d, blocks, &ctx->bs);
+			kernel_neon_end();
+		} else {
+			for (; blocks; blocks--) {
+				AES_decrypt(s, d, &ctx->dec);
+				s += AES_BLOCK_SIZE;
+				d += AES_BLOCK_SIZE;
+			}
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes % AES_BLOCK_SIZE);
+	}
+	return err;
+}
+
+static int cbc_encrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		unsigned int blocks = nbytes / AES_BLOCK_SIZE;
+		u8 *s = walk.src.virt.addr;
+		u8 *d = walk.dst.virt.addr;
+
+		for (; blocks; blocks--) {
+			crypto_xor(walk.iv, s, AES_BLOCK_SIZE);
+			AES_encrypt(walk.iv, d, &ctx->enc);
+			memcpy(walk.iv, d, AES_BLOCK_SIZE);
+			s += AES_BLOCK_SIZE;
+			d += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes % AES_BLOCK_SIZE);
+	}
+	return err;
+}
+
+static int cbc_decrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	u8 prev[AES_BLOCK_SIZE];
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk,
+					AESBS_BLOCKS * AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes)) {
+		unsigned int blocks = nbytes / AES_BLOCK_SIZE;
+		u8 *s = walk.src.virt.addr;
+		u8 *d = walk.dst.virt.addr;
+
+		if (aesbs_use_neon()) {
+			kernel_neon_begin();
+			aesbs_cbc_decrypt(s, d, blocks, &ctx->bs, walk.iv);
+			kernel_neon_end();
+		} else {
+			for (; blocks; blocks--) {
+				memcpy(prev, s, AES_BLOCK_SIZE);
+				AES_decrypt(s, d, &ctx->dec);
+				crypto_xor(d, walk.iv, AES_BLOCK_SIZE);
+				memcpy(walk.iv, prev, AES_BLOCK_SIZE);
+				s += AES_BLOCK_SIZE;
+				d += AES_BLOCK_SIZE;
+			}
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes % AES_BLOCK_SIZE);
+	}
+	return err;
+}
+
+static void ctr_crypt_scalar(struct aesbs_ctx *ctx, u8 *ctr, const u8 *s,
+			     u8 *d, unsigned int nbytes)
+{
+	u8 ks[AES_BLOCK_SIZE];
+
+	while (nbytes) {
+		unsigned int n = min_t(unsigned int, nbytes, AES_BLOCK_SIZE);
+
+		AES_encrypt(ctr, ks, &ctx->enc);
+		crypto_inc(ctr, AES_BLOCK_SIZE);
+		crypto_xor(ks, s, n);
+		memcpy(d, ks, n);
+		s += n;
+		d += n;
+		nbytes -= n;
+	}
+}
+
+static int ctr_crypt(struct blkcipher_desc *desc,
+		     struct scatterlist *dst, struct scatterlist *src,
+		     unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk,
+					AESBS_BLOCKS * AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes) >= AES_BLOCK_SIZE) {
+		unsigned int blocks = nbytes / AES_BLOCK_SIZE;
+		u8 *s = walk.src.virt.addr;
+		u8 *d = walk.dst.virt.addr;
+
+		if (aesbs_use_neon()) {
+			kernel_neon_begin();
+			aesbs_ctr_encrypt(s, d, blocks, &ctx->bs, walk.iv);
+			kernel_neon_end();
+		} else {
+			ctr_crypt_scalar(ctx, walk.iv, s, d,
+					 blocks * AES_BLOCK_SIZE);
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes % AES_BLOCK_SIZE);
+	}
+	/* the final partial block is handled by the scalar code */
+	if (walk.nbytes) {
+		ctr_crypt_scalar(ctx, walk.iv, walk.src.virt.addr,
+				 walk.dst.virt.addr, walk.nbytes);
+		err = blkcipher_walk_done(desc, &walk, 0);
+	}
+	return err;
+}
+
+static void xts_crypt_scalar(AES_KEY *key, u8 *tweak, const u8 *s, u8 *d,
+			     unsigned int blocks, bool enc)
+{
+	u8 buf[AES_BLOCK_SIZE];
+	be128 t;
+
+	memcpy(&t, tweak, AES_BLOCK_SIZE);
+	for (; blocks; blocks--) {
+		memcpy(buf, s, AES_BLOCK_SIZE);
+		crypto_xor(buf, (u8 *)&t, AES_BLOCK_SIZE);
+		if (enc)
+			AES_encrypt(buf, buf, key);
+		else
+			AES_decrypt(buf, buf, key);
+		crypto_xor(buf, (u8 *)&t, AES_BLOCK_SIZE);
+		memcpy(d, buf, AES_BLOCK_SIZE);
+		gf128mul_x_ble(&t, &t);
+		s += AES_BLOCK_SIZE;
+		d += AES_BLOCK_SIZE;
+	}
+	memcpy(tweak, &t, AES_BLOCK_SIZE);
+}
+
+static int xts_crypt(struct blkcipher_desc *desc,
+		     struct scatterlist *dst, struct scatterlist *src,
+		     unsigned int nbytes, bool enc)
+{
+	struct aesbs_xts_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk,
+					AESBS_BLOCKS * AES_BLOCK_SIZE);
+
+	/* generate the initial tweak */
+	AES_encrypt(walk.iv, walk.iv, &ctx->twkey);
+
+	while ((nbytes = walk.nbytes)) {
+		unsigned int blocks = nbytes / AES_BLOCK_SIZE;
+		u8 *s = walk.src.virt.addr;
+		u8 *d = walk.dst.virt.addr;
+
+		if (aesbs_use_neon()) {
+			kernel_neon_begin();
+			if (enc)
+				aesbs_xts_encrypt(s, d, blocks, &ctx->crypt.bs,
+						  walk.iv);
+			else
+				aesbs_xts_decrypt(s, d, blocks, &ctx->crypt.bs,
+						  walk.iv);
+			kernel_neon_end();
+		} else {
+			xts_crypt_scalar(enc ? &ctx->crypt.enc : &ctx->crypt.dec,
+					 walk.iv, s, d, blocks, enc);
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes % AES_BLOCK_SIZE);
+	}
+	return err;
+}
+
+static int xts_encrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int xts_decrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, false);
+}
+
+static struct crypto_alg aesbs_algs[] = { {
+	.cra_name		= "ecb(aes)",
+	.cra_driver_name	= "ecb-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.setkey		= aesbs_set_key,
+			.encrypt	= ecb_encrypt,
+			.decrypt	= ecb_decrypt,
+		},
+	},
+}, {
+	.cra_name		= "cbc(aes)",
+	.cra_driver_name	= "cbc-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_set_key,
+			.encrypt	= cbc_encrypt,
+			.decrypt	= cbc_decrypt,
+		},
+	},
+}, {
+	.cra_name		= "ctr(aes)",
+	.cra_driver_name	= "ctr-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_set_key,
+			.encrypt	= ctr_crypt,
+			.decrypt	= ctr_crypt,
+		},
+	},
+}, {
+	.cra_name		= "xts(aes)",
+	.cra_driver_name	= "xts-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_xts_ctx),
+	.cra_alignmask		= 0,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_xts_set_key,
+			.encrypt	= xts_encrypt,
+			.decrypt	= xts_decrypt,
+		},
+	},
+} };
+
+static int __init aesbs_mod_init(void)
+{
+	if (!cpu_has_neon())
+		return -ENODEV;
+
+	return crypto_register_algs(aesbs_algs, ARRAY_SIZE(aesbs_algs));
+}
+
+static void __exit aesbs_mod_exit(void)
+{
+	crypto_unregister_algs(aesbs_algs, ARRAY_SIZE(aesbs_algs));
+}
+
+module_init(aesbs_mod_init);
+module_exit(aesbs_mod_exit);
+
+MODULE_DESCRIPTION("Bit sliced AES in ECB/CBC/CTR/XTS modes using NEON");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("ecb(aes)");
+MODULE_ALIAS("cbc(aes)");
+MODULE_ALIAS("ctr(aes)");
+MODULE_ALIAS("xts(aes)");
@@ -0,0 +1,45 @@
+/*
+ * Bit sliced AES using NEON instructions
+ *
+ * The core routines in aesbs-core.c are built with -mfpu=neon and must only
+ * be called between kernel_neon_begin() and kernel_neon_end().
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ARM_AESBS_H
+#define __ARM_AESBS_H
+
+#include <linux/compiler.h>
+#include <linux/types.h>
+
+/* number of blocks processed in parallel by the bit sliced core */
+#define AESBS_BLOCKS		8
+
+/*
+ * Bit sliced round keys: each round key is stored as eight 128-bit words,
+ * one per bit of every byte, replicated over all blocks of a batch.
+ */
+struct aesbs_key {
+	u64	rk[15 * 8 * 2] __aligned(16);
+	int	rounds;
+};
+
+void aesbs_convert_key(struct aesbs_key *key, const u32 *rk, int rounds);
+
+void aesbs_ecb_encrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key);
+void aesbs_ecb_decrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key);
+void aesbs_cbc_decrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *iv);
+void aesbs_ctr_encrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *ctr);
+void aesbs_xts_encrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *tweak);
+void aesbs_xts_decrypt(const u8 *in, u8 *out, unsigned int blocks,
+		       const struct aesbs_key *key, u8 *tweak);
+
+#endif /* __ARM_AESBS_H */
@@ -0,0 +1,247 @@
+/*
+ * CRC32C (Castagnoli) using three interleaved slice-by-8 streams
+ *
+ * A single slice-by-8 stream is bound by the latency of its table loads,
+ * since every eight bytes depend on the crc of the previous eight. Large
+ * buffers are therefore cut into chunks of three blocks that are
+ * checksummed as independent streams, which lets an out-of-order core such
+ * as Krait or Cortex-A15 overlap the loads of all three. The partial crcs
+ * are then folded together: crc(A || B) = shift(crc(A)) ^ crc0(B), where
+ * shift() multiplies by x^(8 * CRC32C_BLOCK) modulo the polynomial and is
+ * linear in the bits of its argument, so it is done with four more lookup
+ * tables.
+ *
+ * Without a 64-bit polynomial multiply the fold cannot be done cheaply in
+ * NEON registers, so everything here is plain integer code.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/kernel.h>
+#include <crypto/internal/hash.h>
+#include <asm/unaligned.h>
+
+#define CHKSUM_BLOCK_SIZE	1
+#define CHKSUM_DIGEST_SIZE	4
+
+#define CRC32C_POLY_LE		0x82F63B78
+
+/* bytes per stream in one chunk, must be a multiple of 8 */
+#define CRC32C_BLOCK		256
+
+static u32 crc32c_table[8][256] __read_mostly;
+static u32 crc32c_shift_table[4][256] __read_mostly;
+
+/* one slice-by-8 step on 8 bytes at p */
+#define CRC_STEP8(crc, p) do {						\
+		u32 q = (crc) ^ get_unaligned_le32(p);			\
+		u32 r = get_unaligned_le32((p) + 4);			\
+		(crc) = t[7][q & 255] ^ t[6][(q >> 8) & 255] ^		\
+			t[5][(q >> 16) & 255] ^ t[4][q >> 24] ^		\
+			t[3][r & 255] ^ t[2][(r >> 8) & 255] ^		\
+			t[1][(r >> 16) & 255] ^ t[0][r >> 24];		\
+	} while (0)
+
+static u32 crc32c_bytes(u32 crc, const u8 *p, size_t len)
+{
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 255] ^ (crc >> 8);
+
+	return crc;
+}
+
+static u32 crc32c_sliceby8(u32 crc, const u8 *p, size_t len)
+{
+	const u32 (*t)[256] = crc32c_table;
+
+	for (; len >= 8; len -= 8, p += 8)
+		CRC_STEP8(crc, p);
+
+	return crc32c_bytes(crc, p, len);
+}
+
+static inline u32 crc32c_shift(u32 crc)
+{
+	return crc32c_shift_table[0][crc & 255] ^
+	       crc32c_shift_table[1][(crc >> 8) & 255] ^
+	       crc32c_shift_table[2][(crc >> 16) & 255] ^
+	       crc32c_shift_table[3][crc >> 24];
+}
+
+static u32 __pure crc32c_arm_le(u32 crc, const u8 *p, size_t len)
+{
+	const u32 (*t)[256] = crc32c_table;
+
+	while (len >= 3 * CRC32C_BLOCK) {
+		u32 crc1 = 0, crc2 = 0;
+		const u8 *end = p + CRC32C_BLOCK;
+
+		for (; p < end; p += 8) {
+			CRC_STEP8(crc, p);
+			CRC_STEP8(crc1, p + CRC32C_BLOCK);
+			CRC_STEP8(crc2, p + 2 * CRC32C_BLOCK);
+		}
+
+		crc = crc32c_shift(crc32c_shift(crc) ^ crc1) ^ crc2;
+
+		p += 2 * CRC32C_BLOCK;
+		len -= 3 * CRC32C_BLOCK;
+	}
+
+	return crc32c_sliceby8(crc, p, len);
+}
+
+static void __init crc32c_init_tables(void)
+{
+	static u8 zeroes[CRC32C_BLOCK] __initdata;
+	u32 basis[32];
+	u32 crc;
+	int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY_LE : 0);
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			crc32c_table[k][i] =
+				crc32c_table[0][crc32c_table[k - 1][i] & 255] ^
+				(crc32c_table[k - 1][i] >> 8);
+
+	/* shifting a crc over a block of zeroes is linear in its bits */
+	for (j = 0; j < 32; j++)
+		basis[j] = crc32c_sliceby8(1U << j, zeroes, CRC32C_BLOCK);
+
+	for (k = 0; k < 4; k++)
+		for (i = 0; i < 256; i++) {
+			crc = 0;
+			for (j = 0; j < 8; j++)
+				if (i & (1 << j))
+					crc ^= basis[8 * k + j];
+			crc32c_shift_table[k][i] = crc;
+		}
+}
+
+/*
+ * Setting the seed allows arbitrary accumulators and flexible XOR policy
+ * If your algorithm starts with ~0, then XOR with ~0 before you set
+ * the seed.
+ */
+static int crc32c_arm_setkey(struct crypto_shash *hash, const u8 *key,
+			     unsigned int keylen)
+{
+	u32 *mctx = crypto_shash_ctx(hash);
+
+	if (keylen != sizeof(u32)) {
+		crypto_shash_set_flags(hash, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+	*mctx = le32_to_cpup((__le32 *)key);
+	return 0;
+}
+
+static int crc32c_arm_init(struct shash_desc *desc)
+{
+	u32 *mctx = crypto_shash_ctx(desc->tfm);
+	u32 *crcp = shash_desc_ctx(desc);
+
+	*crcp = *mctx;
+
+	return 0;
+}
+
+static int crc32c_arm_update(struct shash_desc *desc, const u8 *data,
+			     unsigned int len)
+{
+	u32 *crcp = shash_desc_ctx(desc);
+
+	*crcp = crc32c_arm_le(*crcp, data, len);
+	return 0;
+}
+
+static int __crc32c_arm_finup(u32 *crcp, const u8 *data, unsigned int len,
+			      u8 *out)
+{
+	*(__le32 *)out = ~cpu_to_le32(crc32c_arm_le(*crcp, data, len));
+	return 0;
+}
+
+static int crc32c_arm_finup(struct shash_desc *desc, const u8 *data,
+			    unsigned int len, u8 *out)
+{
+	return __crc32c_arm_finup(shash_desc_ctx(desc), data, len, out);
+}
+
+static int crc32c_arm_final(struct shash_desc *desc, u8 *out)
+{
+	u32 *crcp = shash_desc_ctx(desc);
+
+	*(__le32 *)out = ~cpu_to_le32p(crcp);
+	return 0;
+}
+
+static int crc32c_arm_digest(struct shash_desc *desc, const u8 *data,
+			     unsigned int len, u8 *out)
+{
+	return __crc32c_arm_finup(crypto_shash_ctx(desc->tfm), data, len,
+				  out);
+}
+
+static int crc32c_arm_cra_init(struct crypto_tfm *tfm)
+{
+	u32 *key = crypto_tfm_ctx(tfm);
+
+	*key = ~0;
+
+	return 0;
+}
+
+static struct shash_alg alg = {
+	.setkey			=	crc32c_arm_setkey,
+	.init			=	crc32c_arm_init,
+	.update			=	crc32c_arm_update,
+	.final			=	crc32c_arm_final,
+	.finup			=	crc32c_arm_finup,
+	.digest			=	crc32c_arm_digest,
+	.descsize		=	sizeof(u32),
+	.digestsize		=	CHKSUM_DIGEST_SIZE,
+	.base			=	{
+		.cra_name		=	"crc32c",
+		.cra_driver_name	=	"crc32c-arm",
+		.cra_priority		=	200,
+		.cra_blocksize		=	CHKSUM_BLOCK_SIZE,
+		.cra_ctxsize		=	sizeof(u32),
+		.cra_module		=	THIS_MODULE,
+		.cra_init		=	crc32c_arm_cra_init,
+	}
+};
+
+static int __init crc32c_arm_mod_init(void)
+{
+	crc32c_init_tables();
+
+	return crypto_register_shash(&alg);
+}
+
+static void __exit crc32c_arm_mod_fini(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(crc32c_arm_mod_init);
+module_exit(crc32c_arm_mod_fini);
+
+MODULE_DESCRIPTION("CRC32c (Castagnoli) using interleaved slice-by-8 streams");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("crc32c");
+MODULE_ALIAS("crc32c-arm");
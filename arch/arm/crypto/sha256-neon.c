@@ -0,0 +1,162 @@
+/*
+ * SHA-256 block transform using NEON instructions
+ *
+ * The message schedule is computed four words at a time in 128-bit vector
+ * registers, and the round constants are added in the same pass, so the
+ * integer pipeline only has to run the compression rounds themselves.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+
+#ifndef __ARM_NEON__
+#error You should compile this file with '-mfloat-abi=softfp -mfpu=neon'
+#endif
+
+typedef u32 u32x4 __attribute__((vector_size(16)));
+
+static const u32 sha256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline u32x4 ror4(u32x4 x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline u32x4 s0_4(u32x4 x)
+{
+	return ror4(x, 7) ^ ror4(x, 18) ^ (x >> 3);
+}
+
+static inline u32x4 s1_4(u32x4 x)
+{
+	return ror4(x, 17) ^ ror4(x, 19) ^ (x >> 10);
+}
+
+/*
+ * Compute W[t..t+3] from the previous sixteen words held in v0..v3. The
+ * last two words depend on the first two, so sigma1 is applied in two
+ * halves.
+ */
+static inline u32x4 schedule4(u32x4 v0, u32x4 v1, u32x4 v2, u32x4 v3)
+{
+	const u32x4 zero = { 0, 0, 0, 0 };
+	u32x4 w15 = __builtin_shuffle(v0, v1, (u32x4){ 1, 2, 3, 4 });
+	u32x4 w7 = __builtin_shuffle(v2, v3, (u32x4){ 1, 2, 3, 4 });
+	u32x4 x;
+
+	x = v0 + s0_4(w15) + w7;
+	x += s1_4(__builtin_shuffle(v3, zero, (u32x4){ 2, 3, 4, 5 }));
+	x += s1_4(__builtin_shuffle(x, zero, (u32x4){ 4, 5, 0, 1 }));
+	return x;
+}
+
+/* arrays on the stack are only 8 byte aligned, let GCC emit unaligned vld1 */
+static inline u32x4 load4(const u32 *p)
+{
+	u32x4 x;
+
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline void store4(u32 *p, u32x4 x)
+{
+	memcpy(p, &x, sizeof(x));
+}
+
+#define Ch(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define Maj(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define e0(x)		(ror32(x, 2) ^ ror32(x, 13) ^ ror32(x, 22))
+#define e1(x)		(ror32(x, 6) ^ ror32(x, 11) ^ ror32(x, 25))
+
+#define ROUND(a, b, c, d, e, f, g, h, i) do {				\
+		u32 t1 = h + e1(e) + Ch(e, f, g) + wk[i];		\
+		u32 t2 = e0(a) + Maj(a, b, c);				\
+		d += t1;						\
+		h = t1 + t2;						\
+	} while (0)
+
+void sha256_neon_blocks(u32 *state, const u8 *data, unsigned int blocks)
+{
+	u32 wk[64];
+	u32 a, b, c, d, e, f, g, h;
+	u32x4 v0, v1, v2, v3, x;
+	int i;
+
+	while (blocks--) {
+		u32 w[16];
+
+		for (i = 0; i < 16; i++)
+			w[i] = get_unaligned_be32(data + 4 * i);
+		data += 64;
+
+		v0 = load4(w);
+		v1 = load4(w + 4);
+		v2 = load4(w + 8);
+		v3 = load4(w + 12);
+		store4(wk, v0 + load4(sha256_K));
+		store4(wk + 4, v1 + load4(sha256_K + 4));
+		store4(wk + 8, v2 + load4(sha256_K + 8));
+		store4(wk + 12, v3 + load4(sha256_K + 12));
+		for (i = 16; i < 64; i += 4) {
+			x = schedule4(v0, v1, v2, v3);
+			store4(wk + i, x + load4(sha256_K + i));
+			v0 = v1;
+			v1 = v2;
+			v2 = v3;
+			v3 = x;
+		}
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (i = 0; i < 64; i += 8) {
+			ROUND(a, b, c, d, e, f, g, h, i + 0);
+			ROUND(h, a, b, c, d, e, f, g, i + 1);
+			ROUND(g, h, a, b, c, d, e, f, i + 2);
+			ROUND(f, g, h, a, b, c, d, e, i + 3);
+			ROUND(e, f, g, h, a, b, c, d, i + 4);
+			ROUND(d, e, f, g, h, a, b, c, i + 5);
+			ROUND(c, d, e, f, g, h, a, b, i + 6);
+			ROUND(b, c, d, e, f, g, h, a, i + 7);
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
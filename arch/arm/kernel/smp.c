@@ -25,6 +25,7 @@
 #include <linux/percpu.h>
 #include <linux/clockchips.h>
 #include <linux/completion.h>
+#include <linux/irq_work.h>
 
 #include <linux/atomic.h>
 #include <asm/cacheflush.h>
@@ -53,6 +54,7 @@ enum ipi_msg_type {
 	IPI_CALL_FUNC_SINGLE,
 	IPI_CPU_STOP,
 	IPI_CPU_BACKTRACE,
+	IPI_IRQ_WORK,
 };
 
 static DECLARE_COMPLETION(cpu_running);
@@ -102,10 +104,11 @@ int __cpuinit __cpu_up(unsigned int cpu)
 #ifdef CONFIG_HOTPLUG_CPU
 static void percpu_timer_stop(void);
 
+static DEFINE_PER_CPU(struct completion, cpu_died);
+
 int __cpu_disable(void)
 {
 	unsigned int cpu = smp_processor_id();
-	struct task_struct *p;
 	int ret;
 
 	ret = platform_cpu_disable(cpu);
@@ -118,9 +121,26 @@ int __cpu_disable(void)
 
 	percpu_timer_stop();
 
-	flush_cache_all();
+	/*
+	 * This runs with every other cpu stopped. The caches are flushed by
+	 * platform_cpu_die() on the way down, and the mm masks are cleared
+	 * by __cpu_die().
+	 */
 	local_flush_tlb_all();
 
+	/*
+	 * Several cpus can go down in one batch, so each one signals its own
+	 * death. Nobody waits for it before the batch has been stopped.
+	 */
+	init_completion(&per_cpu(cpu_died, cpu));
+
+	return 0;
+}
+
+void __cpu_die(unsigned int cpu)
+{
+	struct task_struct *p;
+
 	read_lock(&tasklist_lock);
 	for_each_process(p) {
 		if (p->mm)
@@ -128,14 +148,8 @@ int __cpu_disable(void)
 	}
 	read_unlock(&tasklist_lock);
 
-	return 0;
-}
-
-static DECLARE_COMPLETION(cpu_died);
-
-void __cpu_die(unsigned int cpu)
-{
-	if (!wait_for_completion_timeout(&cpu_died, msecs_to_jiffies(5000))) {
+	if (!wait_for_completion_timeout(&per_cpu(cpu_died, cpu),
+					 msecs_to_jiffies(5000))) {
 		pr_err("CPU%u: cpu didn't die\n", cpu);
 		return;
 	}
@@ -155,7 +169,7 @@ void __ref cpu_die(void)
 	mb();
 
 	
-	RCU_NONIDLE(complete(&cpu_died));
+	RCU_NONIDLE(complete(&per_cpu(cpu_died, cpu)));
 
 	platform_cpu_die(cpu);
 
@@ -292,6 +306,7 @@ static const char *ipi_types[NR_IPI] = {
 	S(IPI_CALL_FUNC_SINGLE, "Single function call interrupts"),
 	S(IPI_CPU_STOP, "CPU stop interrupts"),
 	S(IPI_CPU_BACKTRACE, "CPU backtrace"),
+	S(IPI_IRQ_WORK, "IRQ work interrupts"),
 };
 
 void show_ipi_list(struct seq_file *p, int prec)
@@ -505,6 +520,14 @@ void handle_IPI(int ipinr, struct pt_regs *regs)
 		ipi_cpu_backtrace(cpu, regs);
 		break;
 
+#ifdef CONFIG_IRQ_WORK
+	case IPI_IRQ_WORK:
+		irq_enter();
+		irq_work_run();
+		irq_exit();
+		break;
+#endif
+
 	default:
 		printk(KERN_CRIT "CPU%u: Unknown IPI message 0x%x\n",
 		       cpu, ipinr);
@@ -518,6 +541,14 @@ void smp_send_reschedule(int cpu)
 	smp_cross_call(cpumask_of(cpu), IPI_RESCHEDULE);
 }
 
+#ifdef CONFIG_IRQ_WORK
+void arch_irq_work_raise(void)
+{
+	if (is_smp())
+		smp_cross_call(cpumask_of(smp_processor_id()), IPI_IRQ_WORK);
+}
+#endif
+
 #ifdef CONFIG_HOTPLUG_CPU
 static void smp_kill_cpus(cpumask_t *mask)
 {
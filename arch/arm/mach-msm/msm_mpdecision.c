@@ -0,0 +1,569 @@
+/*
+ * In-kernel core online/offline decisions from the MSM run queue stats
+ *
+ * Every sample_ms the averaged run queue depth and the per-cpu load at max
+ * frequency collected by msm_rq_stats are read (which restarts their
+ * averaging windows) and compared against the number of online cpus:
+ *
+ *	up:   rq_avg >= 10 * n + rq_up_margin, or average load >= up_load
+ *	down: rq_avg < 10 * (n - 1) - rq_down_margin, and the total load
+ *	      fits in n - 1 cpus at down_load each
+ *
+ * with rq_avg in tenths of a task. A condition has to hold for
+ * up_delay_ms or down_delay_ms before one cpu is added or removed, and a
+ * cpu is not taken down before it has been online for min_online_ms.
+ * Touchscreen and keypad input brings boost_cpus cpus online at once and
+ * keeps them for boost_ms after the last event.
+ *
+ * The stats file reports the number of transitions and their decision
+ * latency, from the sample (or input event) that first asked for the
+ * change until cpu_up()/cpu_down() returned. Writing to it resets them.
+ *
+ * This replaces the userspace mpdecision daemon, which must not run at the
+ * same time: both would consume the same rq-stats windows.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
+#include <linux/jiffies.h>
+#include <linux/kobject.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/sysfs.h>
+#include <linux/workqueue.h>
+#include <linux/rq_stats.h>
+
+#define DEF_SAMPLE_MS		50
+#define DEF_UP_DELAY_MS		100
+#define DEF_DOWN_DELAY_MS	500
+#define DEF_MIN_ONLINE_MS	1000
+#define DEF_RQ_UP_MARGIN	10
+#define DEF_RQ_DOWN_MARGIN	2
+#define DEF_UP_LOAD		90
+#define DEF_DOWN_LOAD		50
+#define DEF_BOOST_MS		1000
+#define DEF_BOOST_CPUS		2
+
+enum {
+	MPD_UP,
+	MPD_DOWN,
+	MPD_DIRS,
+};
+
+static struct mpd_tuners {
+	unsigned int enabled;
+	unsigned int sample_ms;
+	unsigned int up_delay_ms;
+	unsigned int down_delay_ms;
+	unsigned int min_online_ms;
+	unsigned int rq_up_margin;
+	unsigned int rq_down_margin;
+	unsigned int up_load;
+	unsigned int down_load;
+	unsigned int min_cpus;
+	unsigned int max_cpus;
+	unsigned int input_boost;
+	unsigned int boost_ms;
+	unsigned int boost_cpus;
+} mpd_tuners_ins = {
+	.enabled = 1,
+	.sample_ms = DEF_SAMPLE_MS,
+	.up_delay_ms = DEF_UP_DELAY_MS,
+	.down_delay_ms = DEF_DOWN_DELAY_MS,
+	.min_online_ms = DEF_MIN_ONLINE_MS,
+	.rq_up_margin = DEF_RQ_UP_MARGIN,
+	.rq_down_margin = DEF_RQ_DOWN_MARGIN,
+	.up_load = DEF_UP_LOAD,
+	.down_load = DEF_DOWN_LOAD,
+	.min_cpus = 1,
+	.max_cpus = NR_CPUS,
+	.input_boost = 1,
+	.boost_ms = DEF_BOOST_MS,
+	.boost_cpus = DEF_BOOST_CPUS,
+};
+
+struct mpd_stats {
+	unsigned long count;
+	unsigned long failed;
+	u64 total_us;
+	u64 max_us;
+	u64 last_us;
+};
+
+static struct mpd_stats mpd_stats[MPD_DIRS];
+
+/* ktime of the first sample that asked for a change, 0 if none */
+static s64 mpd_since[MPD_DIRS];
+static DEFINE_PER_CPU(s64, mpd_online_since);
+
+static DEFINE_SPINLOCK(mpd_boost_lock);
+static unsigned long mpd_boost_end;
+static s64 mpd_boost_start;
+
+static DEFINE_MUTEX(mpd_mutex);
+static struct workqueue_struct *mpd_wq;
+static struct delayed_work mpd_work;
+static struct work_struct mpd_boost_work;
+static struct kobject *mpd_kobj;
+
+static inline s64 mpd_now_us(void)
+{
+	return ktime_to_us(ktime_get());
+}
+
+static void mpd_account(int dir, s64 since, bool ok)
+{
+	struct mpd_stats *st = &mpd_stats[dir];
+	u64 delta = mpd_now_us() - since;
+
+	if (!ok) {
+		st->failed++;
+		return;
+	}
+
+	st->count++;
+	st->total_us += delta;
+	st->last_us = delta;
+	if (delta > st->max_us)
+		st->max_us = delta;
+}
+
+static bool mpd_cpu_up(s64 since)
+{
+	unsigned int cpu;
+	int ret;
+
+	for_each_present_cpu(cpu) {
+		if (cpu_online(cpu))
+			continue;
+
+		ret = cpu_up(cpu);
+		mpd_account(MPD_UP, since, !ret);
+		return !ret;
+	}
+
+	return false;
+}
+
+/* the least loaded secondary cpu that has been online long enough */
+static bool mpd_cpu_down(s64 since, unsigned int *load, bool force)
+{
+	s64 now = mpd_now_us();
+	unsigned int cpu, victim = nr_cpu_ids, min_load = UINT_MAX;
+	int ret;
+
+	for_each_online_cpu(cpu) {
+		if (!cpu)
+			continue;
+		if (!force && now - per_cpu(mpd_online_since, cpu) <
+		    (s64)mpd_tuners_ins.min_online_ms * USEC_PER_MSEC)
+			continue;
+		if (load[cpu] < min_load) {
+			min_load = load[cpu];
+			victim = cpu;
+		}
+	}
+
+	if (victim >= nr_cpu_ids)
+		return false;
+
+	ret = cpu_down(victim);
+	mpd_account(MPD_DOWN, since, !ret);
+	return !ret;
+}
+
+static unsigned int mpd_boost_floor(s64 *since)
+{
+	unsigned long flags;
+	unsigned int floor = 0;
+
+	spin_lock_irqsave(&mpd_boost_lock, flags);
+	if (time_before(jiffies, mpd_boost_end)) {
+		floor = mpd_tuners_ins.boost_cpus;
+		*since = mpd_boost_start;
+	}
+	spin_unlock_irqrestore(&mpd_boost_lock, flags);
+
+	return floor;
+}
+
+static bool mpd_held(int dir, bool cond, s64 now, unsigned int delay_ms)
+{
+	if (!cond) {
+		mpd_since[dir] = 0;
+		return false;
+	}
+
+	if (!mpd_since[dir])
+		mpd_since[dir] = now;
+
+	return now - mpd_since[dir] >= (s64)delay_ms * USEC_PER_MSEC;
+}
+
+static void mpd_decide(void)
+{
+	struct mpd_tuners *t = &mpd_tuners_ins;
+	unsigned int load[NR_CPUS] = { 0 };
+	unsigned int rq_avg, total_load = 0, floor, ceil, online, cpu;
+	s64 now = mpd_now_us(), boost_since = now;
+	bool up, down;
+
+	rq_avg = msm_rq_stats_read_avg();
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		load[cpu] = msm_rq_stats_cpu_load(cpu);
+		total_load += load[cpu];
+	}
+	online = num_online_cpus();
+	put_online_cpus();
+
+	ceil = clamp_t(unsigned int, t->max_cpus, 1, num_present_cpus());
+	floor = max(t->min_cpus, mpd_boost_floor(&boost_since));
+	floor = clamp_t(unsigned int, floor, 1, ceil);
+
+	up = rq_avg >= 10 * online + t->rq_up_margin ||
+	     total_load >= t->up_load * online;
+	down = rq_avg + t->rq_down_margin < 10 * (online - 1) &&
+	       total_load <= t->down_load * (online - 1);
+
+	up = mpd_held(MPD_UP, up && online < ceil, now, t->up_delay_ms);
+	down = mpd_held(MPD_DOWN, down && online > floor, now,
+			t->down_delay_ms);
+
+	if (online < floor) {
+		mpd_cpu_up(boost_since);
+		mpd_since[MPD_UP] = 0;
+	} else if (online > ceil) {
+		mpd_cpu_down(now, load, true);
+	} else if (up) {
+		if (mpd_cpu_up(mpd_since[MPD_UP]))
+			mpd_since[MPD_UP] = 0;
+	} else if (down) {
+		if (mpd_cpu_down(mpd_since[MPD_DOWN], load, false))
+			mpd_since[MPD_DOWN] = 0;
+	}
+}
+
+static void mpd_work_fn(struct work_struct *work)
+{
+	mutex_lock(&mpd_mutex);
+	if (mpd_tuners_ins.enabled) {
+		mpd_decide();
+		queue_delayed_work(mpd_wq, &mpd_work,
+				   msecs_to_jiffies(mpd_tuners_ins.sample_ms));
+	}
+	mutex_unlock(&mpd_mutex);
+}
+
+static void mpd_boost_work_fn(struct work_struct *work)
+{
+	s64 since = 0;
+	unsigned int floor;
+
+	mutex_lock(&mpd_mutex);
+	floor = min(mpd_boost_floor(&since), mpd_tuners_ins.max_cpus);
+	while (mpd_tuners_ins.enabled && num_online_cpus() < floor)
+		if (!mpd_cpu_up(since))
+			break;
+	mutex_unlock(&mpd_mutex);
+}
+
+static void mpd_input_event(struct input_handle *handle, unsigned int type,
+			    unsigned int code, int value)
+{
+	unsigned long flags;
+	bool queue;
+
+	if (!mpd_tuners_ins.input_boost || type != EV_SYN ||
+	    code != SYN_REPORT)
+		return;
+
+	spin_lock_irqsave(&mpd_boost_lock, flags);
+	queue = !time_before(jiffies, mpd_boost_end);
+	if (queue)
+		mpd_boost_start = mpd_now_us();
+	mpd_boost_end = jiffies + msecs_to_jiffies(mpd_tuners_ins.boost_ms);
+	spin_unlock_irqrestore(&mpd_boost_lock, flags);
+
+	if (queue && num_online_cpus() < mpd_tuners_ins.boost_cpus)
+		queue_work(mpd_wq, &mpd_boost_work);
+}
+
+static int input_dev_filter(const char *input_dev_name)
+{
+	if (strstr(input_dev_name, "touchscreen") ||
+	    strstr(input_dev_name, "keypad"))
+		return 0;
+	else
+		return 1;
+}
+
+static int mpd_input_connect(struct input_handler *handler,
+			     struct input_dev *dev,
+			     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	if (input_dev_filter(dev->name))
+		return -ENODEV;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "msm_mpdecision";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err2;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err1;
+
+	return 0;
+err1:
+	input_unregister_handle(handle);
+err2:
+	kfree(handle);
+	return error;
+}
+
+static void mpd_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id mpd_ids[] = {
+	{ .driver_info = 1 },
+	{ },
+};
+
+static struct input_handler mpd_input_handler = {
+	.event		= mpd_input_event,
+	.connect	= mpd_input_connect,
+	.disconnect	= mpd_input_disconnect,
+	.name		= "msm_mpdecision",
+	.id_table	= mpd_ids,
+};
+
+static int __cpuinit mpd_cpu_callback(struct notifier_block *nfb,
+				      unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_ONLINE:
+		per_cpu(mpd_online_since, cpu) = mpd_now_us();
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __refdata mpd_cpu_notifier = {
+	.notifier_call = mpd_cpu_callback,
+};
+
+#define show_one(file_name, object)					\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct kobj_attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", mpd_tuners_ins.object);		\
+}
+
+#define store_one(file_name, object, min)				\
+static ssize_t store_##file_name					\
+(struct kobject *kobj, struct kobj_attribute *attr,			\
+ const char *buf, size_t count)						\
+{									\
+	unsigned int input;						\
+									\
+	if (sscanf(buf, "%u", &input) != 1 || input < (min))		\
+		return -EINVAL;						\
+									\
+	mutex_lock(&mpd_mutex);						\
+	mpd_tuners_ins.object = input;					\
+	mutex_unlock(&mpd_mutex);					\
+	return count;							\
+}
+
+#define mpd_attr_rw(name, min)						\
+show_one(name, name)							\
+store_one(name, name, min)						\
+static struct kobj_attribute name##_attr =				\
+	__ATTR(name, 0644, show_##name, store_##name)
+
+mpd_attr_rw(sample_ms, 10);
+mpd_attr_rw(up_delay_ms, 0);
+mpd_attr_rw(down_delay_ms, 0);
+mpd_attr_rw(min_online_ms, 0);
+mpd_attr_rw(rq_up_margin, 0);
+mpd_attr_rw(rq_down_margin, 0);
+mpd_attr_rw(up_load, 1);
+mpd_attr_rw(down_load, 0);
+mpd_attr_rw(min_cpus, 1);
+mpd_attr_rw(max_cpus, 1);
+mpd_attr_rw(input_boost, 0);
+mpd_attr_rw(boost_ms, 0);
+mpd_attr_rw(boost_cpus, 0);
+
+static ssize_t show_enabled(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", mpd_tuners_ins.enabled);
+}
+
+static ssize_t store_enabled(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned int input;
+
+	if (sscanf(buf, "%u", &input) != 1)
+		return -EINVAL;
+
+	input = !!input;
+
+	mutex_lock(&mpd_mutex);
+	if (input == mpd_tuners_ins.enabled) {
+		mutex_unlock(&mpd_mutex);
+		return count;
+	}
+	mpd_tuners_ins.enabled = input;
+	mpd_since[MPD_UP] = mpd_since[MPD_DOWN] = 0;
+	mutex_unlock(&mpd_mutex);
+
+	if (input)
+		queue_delayed_work(mpd_wq, &mpd_work, 0);
+	else
+		cancel_delayed_work_sync(&mpd_work);
+
+	return count;
+}
+
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, show_enabled, store_enabled);
+
+static ssize_t show_stats(struct kobject *kobj,
+			  struct kobj_attribute *attr, char *buf)
+{
+	static const char * const names[MPD_DIRS] = { "up", "down" };
+	ssize_t len;
+	int i;
+
+	len = sprintf(buf, "%-5s %10s %10s %12s %12s %12s\n", "", "count",
+		      "failed", "avg_us", "max_us", "last_us");
+
+	mutex_lock(&mpd_mutex);
+	for (i = 0; i < MPD_DIRS; i++) {
+		struct mpd_stats *st = &mpd_stats[i];
+
+		len += sprintf(buf + len, "%-5s %10lu %10lu %12llu %12llu %12llu\n",
+			       names[i], st->count, st->failed,
+			       st->count ? div_u64(st->total_us, st->count) : 0,
+			       st->max_us, st->last_us);
+	}
+	mutex_unlock(&mpd_mutex);
+
+	return len;
+}
+
+static ssize_t store_stats(struct kobject *kobj,
+			   struct kobj_attribute *attr,
+			   const char *buf, size_t count)
+{
+	mutex_lock(&mpd_mutex);
+	memset(mpd_stats, 0, sizeof(mpd_stats));
+	mutex_unlock(&mpd_mutex);
+
+	return count;
+}
+
+static struct kobj_attribute stats_attr =
+	__ATTR(stats, 0644, show_stats, store_stats);
+
+static struct attribute *mpd_attrs[] = {
+	&enabled_attr.attr,
+	&sample_ms_attr.attr,
+	&up_delay_ms_attr.attr,
+	&down_delay_ms_attr.attr,
+	&min_online_ms_attr.attr,
+	&rq_up_margin_attr.attr,
+	&rq_down_margin_attr.attr,
+	&up_load_attr.attr,
+	&down_load_attr.attr,
+	&min_cpus_attr.attr,
+	&max_cpus_attr.attr,
+	&input_boost_attr.attr,
+	&boost_ms_attr.attr,
+	&boost_cpus_attr.attr,
+	&stats_attr.attr,
+	NULL,
+};
+
+static struct attribute_group mpd_attr_group = {
+	.attrs = mpd_attrs,
+};
+
+static int __init msm_mpdecision_init(void)
+{
+	unsigned int cpu;
+	s64 now = mpd_now_us();
+	int ret;
+
+	if (!rq_info.init || !rq_info.kobj)
+		return -ENODEV;
+
+	mpd_wq = alloc_ordered_workqueue("msm_mpdecision", WQ_FREEZABLE);
+	if (!mpd_wq)
+		return -ENOMEM;
+
+	INIT_DELAYED_WORK_DEFERRABLE(&mpd_work, mpd_work_fn);
+	INIT_WORK(&mpd_boost_work, mpd_boost_work_fn);
+
+	for_each_possible_cpu(cpu)
+		per_cpu(mpd_online_since, cpu) = now;
+	register_hotcpu_notifier(&mpd_cpu_notifier);
+
+	mpd_kobj = kobject_create_and_add("mpdecision", rq_info.kobj);
+	if (!mpd_kobj) {
+		ret = -ENOMEM;
+		goto err_wq;
+	}
+
+	ret = sysfs_create_group(mpd_kobj, &mpd_attr_group);
+	if (ret)
+		goto err_kobj;
+
+	if (input_register_handler(&mpd_input_handler))
+		pr_warn("%s: failed to register input handler\n", __func__);
+
+	queue_delayed_work(mpd_wq, &mpd_work,
+			   msecs_to_jiffies(mpd_tuners_ins.sample_ms));
+
+	return 0;
+
+err_kobj:
+	kobject_put(mpd_kobj);
+err_wq:
+	unregister_hotcpu_notifier(&mpd_cpu_notifier);
+	destroy_workqueue(mpd_wq);
+	return ret;
+}
+late_initcall_sync(msm_mpdecision_init);
@@ -142,23 +142,43 @@ static int update_average_load(unsigned int freq, unsigned int cpu)
 	return 0;
 }
 
+unsigned int msm_rq_stats_cpu_load(unsigned int cpu)
+{
+	struct cpu_load_data *pcpu = &per_cpu(cpuload, cpu);
+	unsigned int load;
+
+	mutex_lock(&pcpu->cpu_load_mutex);
+	update_average_load(pcpu->cur_freq, cpu);
+	load = pcpu->avg_load_maxfreq;
+	pcpu->avg_load_maxfreq = 0;
+	mutex_unlock(&pcpu->cpu_load_mutex);
+
+	return load;
+}
+
 static unsigned int report_load_at_max_freq(void)
 {
 	int cpu;
-	struct cpu_load_data *pcpu;
 	unsigned int total_load = 0;
 
-	for_each_online_cpu(cpu) {
-		pcpu = &per_cpu(cpuload, cpu);
-		mutex_lock(&pcpu->cpu_load_mutex);
-		update_average_load(pcpu->cur_freq, cpu);
-		total_load += pcpu->avg_load_maxfreq;
-		pcpu->avg_load_maxfreq = 0;
-		mutex_unlock(&pcpu->cpu_load_mutex);
-	}
+	for_each_online_cpu(cpu)
+		total_load += msm_rq_stats_cpu_load(cpu);
 	return total_load;
 }
 
+unsigned int msm_rq_stats_read_avg(void)
+{
+	unsigned int val;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rq_lock, flags);
+	val = rq_info.rq_avg;
+	rq_info.rq_avg = 0;
+	spin_unlock_irqrestore(&rq_lock, flags);
+
+	return val;
+}
+
 static int cpufreq_transition_handler(struct notifier_block *nb,
 			unsigned long val, void *data)
 {
@@ -210,14 +230,7 @@ static void def_work_fn(struct work_struct *work)
 static ssize_t run_queue_avg_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
-	unsigned int val = 0;
-	unsigned long flags = 0;
-
-	spin_lock_irqsave(&rq_lock, flags);
-	
-	val = rq_info.rq_avg;
-	rq_info.rq_avg = 0;
-	spin_unlock_irqrestore(&rq_lock, flags);
+	unsigned int val = msm_rq_stats_read_avg();
 
 	return snprintf(buf, PAGE_SIZE, "%d.%d\n", val/10, val%10);
 }
@@ -356,6 +369,7 @@ static int __init msm_rq_stats_init(void)
 		mutex_init(&pcpu->cpu_load_mutex);
 		cpufreq_get_policy(&cpu_policy, i);
 		pcpu->policy_max = cpu_policy.cpuinfo.max_freq;
+		pcpu->cur_freq = cpu_policy.cur;
 		cpumask_copy(pcpu->related_cpus, cpu_policy.cpus);
 	}
 	freq_transition.notifier_call = cpufreq_transition_handler;
@@ -100,6 +100,14 @@ static const int bfq_async_charge_factor = 10;
 static const int bfq_timeout_sync = HZ / 8;
 static int bfq_timeout_async = HZ / 25;
 
+/*
+ * Default read latency targets of the flash mode for the RT, BE and IDLE
+ * classes, in ms; 0 means no target.
+ */
+static const unsigned int bfq_read_lat_target[BFQ_IOPRIO_CLASSES] = {
+	5, 20, 0
+};
+
 struct kmem_cache *bfq_pool;
 
 /* Below this threshold (in ms), we consider thinktime immediate. */
@@ -634,6 +642,8 @@ static void bfq_add_request(struct request *rq)
 	bfq_log_bfqq(bfqd, bfqq, "add_request %d", rq_is_sync(rq));
 	bfqq->queued[rq_is_sync(rq)]++;
 	bfqd->queued++;
+	if (rq_is_sync(rq) && rq_data_dir(rq) == READ)
+		bfqd->queued_reads++;
 
 	elv_rb_add(&bfqq->sort_list, rq);
 
@@ -859,6 +869,8 @@ static void bfq_remove_request(struct request *rq)
 	BUG_ON(bfqq->queued[sync] == 0);
 	bfqq->queued[sync]--;
 	bfqd->queued--;
+	if (sync && rq_data_dir(rq) == READ)
+		bfqd->queued_reads--;
 	elv_rb_del(&bfqq->sort_list, rq);
 
 	if (RB_EMPTY_ROOT(&bfqq->sort_list)) {
@@ -2500,6 +2512,23 @@ static int bfq_forced_dispatch(struct bfq_data *bfqd)
 	return dispatched;
 }
 
+/*
+ * Without the flash mode no async request is dispatched while sync ones
+ * are in flight. In flash mode async requests may keep the device busy
+ * while reads wait, but only up to async_depth of them, and async_depth
+ * is adapted to the read latency targets in bfq_flash_update_depth().
+ */
+static bool bfq_flash_may_dispatch_async(struct bfq_data *bfqd)
+{
+	if (!bfqd->flash_mode)
+		return bfqd->sync_flight == 0;
+
+	if (bfqd->queued_reads == 0 && bfqd->sync_flight == 0)
+		return true;
+
+	return bfqd->rq_in_driver - bfqd->sync_flight < bfqd->async_depth;
+}
+
 static int bfq_dispatch_requests(struct request_queue *q, int force)
 {
 	struct bfq_data *bfqd = q->elevator->elevator_data;
@@ -2531,7 +2560,7 @@ static int bfq_dispatch_requests(struct request_queue *q, int force)
 			return 0;
 	}
 
-	if (bfqd->sync_flight != 0 && !bfq_bfqq_sync(bfqq))
+	if (!bfq_bfqq_sync(bfqq) && !bfq_flash_may_dispatch_async(bfqd))
 		return 0;
 
 	bfq_clear_bfqq_wait_request(bfqq);
@@ -2938,9 +2967,15 @@ static void bfq_update_idle_window(struct bfq_data *bfqd,
 
 	enable_idle = bfq_bfqq_idle_window(bfqq);
 
+	/*
+	 * On flash idling only pays off for weight-raised queues, sequential
+	 * queues don't gain anything from it.
+	 */
 	if (atomic_read(&bic->icq.ioc->nr_tasks) == 0 ||
 	    bfqd->bfq_slice_idle == 0 ||
 		(bfqd->hw_tag && BFQQ_SEEKY(bfqq) &&
+			bfqq->wr_coeff == 1) ||
+		(bfqd->flash_mode && !BFQQ_SEEKY(bfqq) &&
 			bfqq->wr_coeff == 1))
 		enable_idle = 0;
 	else if (bfq_sample_valid(bic->ttime.ttime_samples)) {
@@ -3118,6 +3153,42 @@ static void bfq_update_hw_tag(struct bfq_data *bfqd)
 	bfqd->hw_tag_samples = 0;
 }
 
+/*
+ * Account the latency of a completed sync read, from its allocation to its
+ * completion, and adapt the async depth of the flash mode to it: halve the
+ * depth when the read missed the target of its class, grow it by one when
+ * the target was met.
+ */
+static void bfq_flash_update_depth(struct bfq_data *bfqd,
+				   struct bfq_queue *bfqq, struct request *rq)
+{
+	int class = bfqq->entity.ioprio_class - 1;
+	u64 now = sched_clock();
+	u64 start = rq_start_time_ns(rq);
+	unsigned long lat_us;
+	unsigned int target;
+
+	if (class < 0 || class >= BFQ_IOPRIO_CLASSES || !start || now < start)
+		return;
+
+	lat_us = (unsigned long)min_t(u64, div_u64(now - start, NSEC_PER_USEC),
+				      ULONG_MAX);
+	bfqd->read_lat_hist[class][min(lat_us ? ilog2(lat_us) : 0,
+				       BFQ_LAT_BUCKETS - 1)]++;
+
+	target = bfqd->bfq_read_lat_target[class];
+	if (!bfqd->flash_mode || !target)
+		return;
+
+	if (lat_us > target * USEC_PER_MSEC)
+		bfqd->async_depth = max(bfqd->async_depth / 2, 1U);
+	else if (bfqd->async_depth < bfqd->bfq_quantum)
+		bfqd->async_depth++;
+
+	bfq_log_bfqq(bfqd, bfqq, "read latency %lu us, async depth %u",
+		     lat_us, bfqd->async_depth);
+}
+
 static void bfq_completed_request(struct request_queue *q, struct request *rq)
 {
 	struct bfq_queue *bfqq = RQ_BFQQ(rq);
@@ -3151,6 +3222,8 @@ static void bfq_completed_request(struct request_queue *q, struct request *rq)
 	if (sync) {
 		bfqd->sync_flight--;
 		RQ_BIC(rq)->ttime.last_end_request = jiffies;
+		if (rq_data_dir(rq) == READ)
+			bfq_flash_update_depth(bfqd, bfqq, rq);
 	}
 
 	/*
@@ -3492,6 +3565,7 @@ static void *bfq_init_queue(struct request_queue *q)
 {
 	struct bfq_group *bfqg;
 	struct bfq_data *bfqd;
+	int i;
 
 	bfqd = kzalloc_node(sizeof(*bfqd), GFP_KERNEL, q->node);
 	if (bfqd == NULL)
@@ -3557,6 +3631,11 @@ static void *bfq_init_queue(struct request_queue *q)
 	bfqd->bfq_wr_max_time = 0;
 	bfqd->bfq_wr_min_idle_time = msecs_to_jiffies(2000);
 	bfqd->bfq_wr_min_inter_arr_async = msecs_to_jiffies(500);
+	bfqd->flash_mode = false;
+	for (i = 0; i < BFQ_IOPRIO_CLASSES; i++)
+		bfqd->bfq_read_lat_target[i] = bfq_read_lat_target[i];
+	bfqd->async_depth = 1;
+
 	bfqd->bfq_wr_max_softrt_rate = 7000; /*
 					      * Approximate rate required
 					      * to playback or record a
@@ -3684,6 +3763,11 @@ SHOW_FUNCTION(bfq_wr_min_idle_time_show, bfqd->bfq_wr_min_idle_time, 1);
 SHOW_FUNCTION(bfq_wr_min_inter_arr_async_show, bfqd->bfq_wr_min_inter_arr_async,
 	1);
 SHOW_FUNCTION(bfq_wr_max_softrt_rate_show, bfqd->bfq_wr_max_softrt_rate, 0);
+SHOW_FUNCTION(bfq_flash_mode_show, bfqd->flash_mode, 0);
+SHOW_FUNCTION(bfq_read_latency_target_rt_show, bfqd->bfq_read_lat_target[0], 0);
+SHOW_FUNCTION(bfq_read_latency_target_be_show, bfqd->bfq_read_lat_target[1], 0);
+SHOW_FUNCTION(bfq_read_latency_target_idle_show, bfqd->bfq_read_lat_target[2],
+	0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -3726,8 +3810,84 @@ STORE_FUNCTION(bfq_wr_min_inter_arr_async_store,
 		&bfqd->bfq_wr_min_inter_arr_async, 0, INT_MAX, 1);
 STORE_FUNCTION(bfq_wr_max_softrt_rate_store, &bfqd->bfq_wr_max_softrt_rate, 0,
 		INT_MAX, 0);
+STORE_FUNCTION(bfq_flash_mode_store, &bfqd->flash_mode, 0, 1, 0);
+STORE_FUNCTION(bfq_read_latency_target_rt_store, &bfqd->bfq_read_lat_target[0],
+		0, INT_MAX, 0);
+STORE_FUNCTION(bfq_read_latency_target_be_store, &bfqd->bfq_read_lat_target[1],
+		0, INT_MAX, 0);
+STORE_FUNCTION(bfq_read_latency_target_idle_store,
+		&bfqd->bfq_read_lat_target[2], 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+/*
+ * Return the upper bound, in us, of the histogram bucket that contains the
+ * given percentile of the samples, or 0 if there are no samples.
+ */
+static unsigned long bfq_lat_percentile(unsigned long *hist,
+					unsigned long samples, int pct)
+{
+	unsigned long sum = 0, want = div_u64((u64)samples * pct + 99, 100);
+	int i;
+
+	if (!samples)
+		return 0;
+
+	for (i = 0; i < BFQ_LAT_BUCKETS - 1; i++) {
+		sum += hist[i];
+		if (sum >= want)
+			break;
+	}
+
+	return 2UL << i;
+}
+
+static ssize_t bfq_read_latency_show(struct elevator_queue *e, char *page)
+{
+	static const char * const class_name[BFQ_IOPRIO_CLASSES] = {
+		"rt", "be", "idle"
+	};
+	struct bfq_data *bfqd = e->elevator_data;
+	unsigned long hist[BFQ_LAT_BUCKETS];
+	unsigned long samples;
+	ssize_t num_char = 0;
+	int class, i;
+
+	for (class = 0; class < BFQ_IOPRIO_CLASSES; class++) {
+		spin_lock_irq(bfqd->queue->queue_lock);
+		memcpy(hist, bfqd->read_lat_hist[class], sizeof(hist));
+		spin_unlock_irq(bfqd->queue->queue_lock);
+
+		samples = 0;
+		for (i = 0; i < BFQ_LAT_BUCKETS; i++)
+			samples += hist[i];
+
+		num_char += sprintf(page + num_char,
+				    "%s: samples %lu p50 %lu p90 %lu p99 %lu\n",
+				    class_name[class], samples,
+				    bfq_lat_percentile(hist, samples, 50),
+				    bfq_lat_percentile(hist, samples, 90),
+				    bfq_lat_percentile(hist, samples, 99));
+	}
+
+	num_char += sprintf(page + num_char, "async_depth: %u\n",
+			    bfqd->async_depth);
+
+	return num_char;
+}
+
+/* writing anything resets the histograms */
+static ssize_t bfq_read_latency_store(struct elevator_queue *e,
+				      const char *page, size_t count)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+
+	spin_lock_irq(bfqd->queue->queue_lock);
+	memset(bfqd->read_lat_hist, 0, sizeof(bfqd->read_lat_hist));
+	spin_unlock_irq(bfqd->queue->queue_lock);
+
+	return count;
+}
+
 /* do nothing for the moment */
 static ssize_t bfq_weights_store(struct elevator_queue *e,
 				    const char *page, size_t count)
@@ -3822,6 +3982,11 @@ static struct elv_fs_entry bfq_attrs[] = {
 	BFQ_ATTR(wr_min_inter_arr_async),
 	BFQ_ATTR(wr_max_softrt_rate),
 	BFQ_ATTR(weights),
+	BFQ_ATTR(flash_mode),
+	BFQ_ATTR(read_latency_target_rt),
+	BFQ_ATTR(read_latency_target_be),
+	BFQ_ATTR(read_latency_target_idle),
+	BFQ_ATTR(read_latency),
 	__ATTR_NULL
 };
 
@@ -19,6 +19,9 @@
 #include <linux/rbtree.h>
 
 #define BFQ_IOPRIO_CLASSES	3
+
+/* log2 buckets of the read latency histogram, in microseconds */
+#define BFQ_LAT_BUCKETS		24
 #define BFQ_CL_IDLE_TIMEOUT	(HZ/5)
 
 #define BFQ_MIN_WEIGHT	1
@@ -383,6 +386,7 @@ enum bfq_device_speed {
  *                                     comments to @busy_in_flight_queues).
  * @wr_busy_queues: number of weight-raised busy @bfq_queues.
  * @queued: number of queued requests.
+ * @queued_reads: number of queued sync read requests.
  * @rq_in_driver: number of requests dispatched and waiting for completion.
  * @sync_flight: number of sync requests in the driver.
  * @max_rq_in_driver: max number of reqs in driver in the last
@@ -448,6 +452,13 @@ enum bfq_device_speed {
  * @RT_prod: cached value of the product R*T used for computing the maximum
  *	     duration of the weight raising automatically
  * @device_speed: device-speed class for the low-latency heuristic
+ * @flash_mode: if set, no idling for sequential queues, and async requests
+ *              are dispatched alongside sync reads up to @async_depth
+ * @bfq_read_lat_target: per-class read latency targets of the flash mode,
+ *                       in ms (0 for none)
+ * @async_depth: max number of async requests in the driver while sync reads
+ *               are pending, adapted to the read latency targets
+ * @read_lat_hist: per-class log2 histograms of read latencies, in us
  * @oom_bfqq: fallback dummy bfqq for extreme OOM conditions
  *
  * All the fields are protected by the @queue lock.
@@ -470,6 +481,7 @@ struct bfq_data {
 	int const_seeky_busy_in_flight_queues;
 	int wr_busy_queues;
 	int queued;
+	int queued_reads;
 	int rq_in_driver;
 	int sync_flight;
 
@@ -524,6 +536,12 @@ struct bfq_data {
 	u64 RT_prod;
 	enum bfq_device_speed device_speed;
 
+	/* parameters and state of the flash mode */
+	bool flash_mode;
+	unsigned int bfq_read_lat_target[BFQ_IOPRIO_CLASSES];
+	unsigned int async_depth;
+	unsigned long read_lat_hist[BFQ_IOPRIO_CLASSES][BFQ_LAT_BUCKETS];
+
 	struct bfq_queue oom_bfqq;
 };
 
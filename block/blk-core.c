@@ -49,6 +49,19 @@ struct kmem_cache *blk_requestq_cachep;
 
 static struct workqueue_struct *kblockd_workqueue;
 
+/*
+ * Per-cpu staging list of requests submitted without a plug, inserted
+ * into the elevator in batches so that queue_lock is taken once per
+ * batch rather than once per request.
+ */
+struct blk_sw_queue {
+	spinlock_t		lock;
+	struct list_head	list;
+	unsigned int		count;
+	struct request_queue	*q;
+	struct work_struct	work;
+};
+
 extern atomic_t emmc_reboot;
 
 static void drive_stat_acct(struct request *rq, int new_io)
@@ -210,10 +223,97 @@ void blk_stop_queue(struct request_queue *q)
 }
 EXPORT_SYMBOL(blk_stop_queue);
 
+static void blk_sw_queue_flush(struct blk_sw_queue *swq)
+{
+	struct request_queue *q = swq->q;
+	struct request *rq;
+	unsigned int depth = 0;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&swq->lock);
+	list_splice_init(&swq->list, &list);
+	swq->count = 0;
+	spin_unlock_irq(&swq->lock);
+
+	if (list_empty(&list))
+		return;
+
+	spin_lock_irq(q->queue_lock);
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+
+		if (unlikely(blk_queue_dead(q))) {
+			__blk_end_request_all(rq, -ENODEV);
+			continue;
+		}
+
+		__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+		depth++;
+	}
+
+	if (depth) {
+		trace_block_unplug(q, depth, true);
+		__blk_run_queue(q);
+	}
+	spin_unlock_irq(q->queue_lock);
+}
+
+static void blk_sw_queue_work(struct work_struct *work)
+{
+	blk_sw_queue_flush(container_of(work, struct blk_sw_queue, work));
+}
+
+static void blk_flush_sw_queues(struct request_queue *q)
+{
+	int cpu;
+
+	if (!q->sw_queues)
+		return;
+
+	for_each_possible_cpu(cpu)
+		blk_sw_queue_flush(per_cpu_ptr(q->sw_queues, cpu));
+}
+
+static int blk_init_sw_queues(struct request_queue *q)
+{
+	int cpu;
+
+	if (q->sw_queues)
+		return 0;
+
+	q->sw_queues = alloc_percpu(struct blk_sw_queue);
+	if (!q->sw_queues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_sw_queue *swq = per_cpu_ptr(q->sw_queues, cpu);
+
+		spin_lock_init(&swq->lock);
+		INIT_LIST_HEAD(&swq->list);
+		swq->q = q;
+		INIT_WORK(&swq->work, blk_sw_queue_work);
+	}
+
+	return 0;
+}
+
+void blk_exit_sw_queues(struct request_queue *q)
+{
+	free_percpu(q->sw_queues);
+	q->sw_queues = NULL;
+}
+
 void blk_sync_queue(struct request_queue *q)
 {
+	int cpu;
+
 	del_timer_sync(&q->timeout);
 	cancel_delayed_work_sync(&q->delay_work);
+
+	if (q->sw_queues)
+		for_each_possible_cpu(cpu)
+			flush_work(&per_cpu_ptr(q->sw_queues, cpu)->work);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -257,6 +357,8 @@ void blk_drain_queue(struct request_queue *q, bool drain_all)
 		bool drain = false;
 		int i;
 
+		blk_flush_sw_queues(q);
+
 		spin_lock_irq(q->queue_lock);
 
 		elv_drain_elevator(q);
@@ -369,9 +471,12 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	if (err)
 		goto fail_id;
 
-	if (blk_throtl_init(q))
+	if (blk_lat_hist_init(q))
 		goto fail_bdi;
 
+	if (blk_throtl_init(q))
+		goto fail_lat_hist;
+
 	setup_timer(&q->backing_dev_info.laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
 	setup_timer(&q->timeout, blk_rq_timed_out_timer, (unsigned long) q);
@@ -391,6 +496,8 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 
 	return q;
 
+fail_lat_hist:
+	blk_lat_hist_exit(q);
 fail_bdi:
 	bdi_destroy(&q->backing_dev_info);
 fail_id:
@@ -435,6 +542,9 @@ blk_init_allocated_queue(struct request_queue *q, request_fn_proc *rfn,
 	if (blk_init_free_list(q))
 		return NULL;
 
+	if (blk_init_sw_queues(q))
+		return NULL;
+
 	q->request_fn		= rfn;
 	q->prep_rq_fn		= NULL;
 	q->unprep_rq_fn		= NULL;
@@ -916,6 +1026,67 @@ out:
 	return ret;
 }
 
+static bool attempt_sw_queue_merge(struct request_queue *q, struct bio *bio)
+{
+	struct blk_sw_queue *swq;
+	struct request *rq;
+	bool ret = false;
+
+	swq = get_cpu_ptr(q->sw_queues);
+	spin_lock_irq(&swq->lock);
+
+	list_for_each_entry_reverse(rq, &swq->list, queuelist) {
+		int el_ret;
+
+		if (!blk_rq_merge_ok(rq, bio))
+			continue;
+
+		el_ret = blk_try_merge(rq, bio);
+		if (el_ret == ELEVATOR_BACK_MERGE) {
+			ret = bio_attempt_back_merge(q, rq, bio);
+			if (ret)
+				break;
+		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
+			ret = bio_attempt_front_merge(q, rq, bio);
+			if (ret)
+				break;
+		}
+	}
+
+	spin_unlock_irq(&swq->lock);
+	put_cpu_ptr(q->sw_queues);
+	return ret;
+}
+
+/*
+ * Stage a request on the local software queue. Sync requests, or a full
+ * staging list, flush it right away; otherwise the first request staged
+ * kicks kblockd on this cpu to insert the batch.
+ */
+static void blk_sw_queue_add(struct request_queue *q, struct request *rq)
+{
+	struct blk_sw_queue *swq;
+	bool flush, kick;
+	int cpu;
+
+	drive_stat_acct(rq, 1);
+
+	cpu = get_cpu();
+	swq = per_cpu_ptr(q->sw_queues, cpu);
+	spin_lock_irq(&swq->lock);
+	list_add_tail(&rq->queuelist, &swq->list);
+	kick = ++swq->count == 1;
+	flush = rq_is_sync(rq) || swq->count >= BLK_MAX_REQUEST_COUNT;
+	spin_unlock_irq(&swq->lock);
+
+	if (!flush && kick)
+		queue_work_on(cpu, kblockd_workqueue, &swq->work);
+	put_cpu();
+
+	if (flush)
+		blk_sw_queue_flush(swq);
+}
+
 void init_request_from_bio(struct request *req, struct bio *bio)
 {
 	req->cmd_type = REQ_TYPE_FS;
@@ -935,6 +1106,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 {
 	const bool sync = !!(bio->bi_rw & REQ_SYNC);
 	struct blk_plug *plug;
+	bool swq = false;
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
 	struct request *req;
 	unsigned int request_count = 0;
@@ -950,6 +1122,10 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	if (attempt_plug_merge(q, bio, &request_count))
 		return;
 
+	swq = !current->plug && q->sw_queues && blk_queue_sw_queues(q);
+	if (swq && attempt_sw_queue_merge(q, bio))
+		return;
+
 	spin_lock_irq(q->queue_lock);
 
 	el_ret = elv_merge(q, &req, bio);
@@ -1004,6 +1180,8 @@ get_rq:
 		}
 		list_add_tail(&req->queuelist, &plug->list);
 		drive_stat_acct(req, 1);
+	} else if (swq) {
+		blk_sw_queue_add(q, req);
 	} else {
 		spin_lock_irq(q->queue_lock);
 		add_acct_request(q, req, where);
@@ -1627,6 +1805,7 @@ static void blk_finish_request(struct request *req, int error)
 		blk_unprep_request(req);
 
 
+	blk_lat_hist_done(req);
 	blk_account_io_done(req);
 
 	if (req->end_io)
@@ -0,0 +1,123 @@
+/*
+ * Per-queue request latency histograms
+ *
+ * Completed fs requests are accounted in log2 histograms of their queue
+ * time, from allocation to dispatch to the driver, and of their service
+ * time, from dispatch to completion, split by direction and by sync/async
+ * for writes (reads are always sync). The counters are per-cpu, so the
+ * completion path only pays for a sched_clock() and two increments.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/blkdev.h>
+#include <linux/sched.h>
+
+#include "blk.h"
+
+enum {
+	BLK_LAT_READ,
+	BLK_LAT_WRITE_SYNC,
+	BLK_LAT_WRITE_ASYNC,
+	BLK_LAT_TYPES,
+};
+
+struct blk_lat_hist {
+	unsigned long buckets[BLK_LAT_HIST_KINDS][BLK_LAT_TYPES]
+			     [BLK_LAT_BUCKETS];
+};
+
+int blk_lat_hist_init(struct request_queue *q)
+{
+	q->lat_hist = alloc_percpu(struct blk_lat_hist);
+	if (!q->lat_hist)
+		return -ENOMEM;
+	return 0;
+}
+
+void blk_lat_hist_exit(struct request_queue *q)
+{
+	free_percpu(q->lat_hist);
+	q->lat_hist = NULL;
+}
+
+static inline int blk_lat_bucket(u64 delta_ns)
+{
+	unsigned long us = (unsigned long)min_t(u64,
+				div_u64(delta_ns, NSEC_PER_USEC), ULONG_MAX);
+
+	if (!us)
+		return 0;
+	return min_t(int, ilog2(us), BLK_LAT_BUCKETS - 1);
+}
+
+void blk_lat_hist_done(struct request *rq)
+{
+	struct blk_lat_hist __percpu *hist = rq->q->lat_hist;
+	u64 queued = rq_start_time_ns(rq);
+	u64 started = rq_io_start_time_ns(rq);
+	u64 now;
+	int type;
+
+	if (!hist || rq->cmd_type != REQ_TYPE_FS ||
+	    (rq->cmd_flags & REQ_FLUSH_SEQ) || !started)
+		return;
+
+	if (rq_data_dir(rq) == READ)
+		type = BLK_LAT_READ;
+	else if (rq_is_sync(rq))
+		type = BLK_LAT_WRITE_SYNC;
+	else
+		type = BLK_LAT_WRITE_ASYNC;
+
+	now = sched_clock();
+	if (queued && started >= queued)
+		this_cpu_inc(hist->buckets[BLK_LAT_QUEUE][type]
+				[blk_lat_bucket(started - queued)]);
+	if (now >= started)
+		this_cpu_inc(hist->buckets[BLK_LAT_SERVICE][type]
+				[blk_lat_bucket(now - started)]);
+}
+
+ssize_t blk_lat_hist_show(struct request_queue *q, int kind, char *page)
+{
+	unsigned long sum[BLK_LAT_TYPES];
+	ssize_t len;
+	int cpu, b, t;
+
+	len = sprintf(page, "%-17s %10s %10s %10s\n",
+		      "usecs", "read", "write_sync", "write_async");
+
+	for (b = 0; b < BLK_LAT_BUCKETS; b++) {
+		memset(sum, 0, sizeof(sum));
+		for_each_possible_cpu(cpu) {
+			struct blk_lat_hist *h = per_cpu_ptr(q->lat_hist, cpu);
+
+			for (t = 0; t < BLK_LAT_TYPES; t++)
+				sum[t] += h->buckets[kind][t][b];
+		}
+
+		if (b == BLK_LAT_BUCKETS - 1)
+			len += sprintf(page + len, "%8lu-%-8s", 1UL << b, "");
+		else
+			len += sprintf(page + len, "%8lu-%-8lu",
+				       b ? 1UL << b : 0, (2UL << b) - 1);
+		len += sprintf(page + len, " %10lu %10lu %10lu\n",
+			       sum[BLK_LAT_READ], sum[BLK_LAT_WRITE_SYNC],
+			       sum[BLK_LAT_WRITE_ASYNC]);
+	}
+
+	return len;
+}
+
+void blk_lat_hist_reset(struct request_queue *q, int kind)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_lat_hist *h = per_cpu_ptr(q->lat_hist, cpu);
+
+		memset(h->buckets[kind], 0, sizeof(h->buckets[kind]));
+	}
+}
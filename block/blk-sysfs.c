@@ -240,6 +240,32 @@ static ssize_t queue_nomerges_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+static ssize_t queue_sw_queues_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_sw_queues(q), page);
+}
+
+static ssize_t
+queue_sw_queues_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+
+	if (!q->sw_queues)
+		return -EINVAL;
+
+	ret = queue_var_store(&val, page, count);
+
+	spin_lock_irq(q->queue_lock);
+	if (val)
+		queue_flag_set(QUEUE_FLAG_SW_QUEUES, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_SW_QUEUES, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
 static ssize_t queue_rq_affinity_show(struct request_queue *q, char *page)
 {
 	bool set = test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags);
@@ -272,6 +298,26 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+#ifdef CONFIG_BLK_DEV_LAT_HIST
+#define QUEUE_LAT_HIST_FNS(name, kind)					\
+static ssize_t								\
+queue_##name##_hist_show(struct request_queue *q, char *page)		\
+{									\
+	return blk_lat_hist_show(q, kind, page);			\
+}									\
+static ssize_t								\
+queue_##name##_hist_store(struct request_queue *q, const char *page,	\
+			  size_t count)					\
+{									\
+	blk_lat_hist_reset(q, kind);					\
+	return count;							\
+}
+
+QUEUE_LAT_HIST_FNS(queue_time, BLK_LAT_QUEUE);
+QUEUE_LAT_HIST_FNS(service_time, BLK_LAT_SERVICE);
+#undef QUEUE_LAT_HIST_FNS
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -374,6 +420,12 @@ static struct queue_sysfs_entry queue_rq_affinity_entry = {
 	.store = queue_rq_affinity_store,
 };
 
+static struct queue_sysfs_entry queue_sw_queues_entry = {
+	.attr = {.name = "sw_queues", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_sw_queues_show,
+	.store = queue_sw_queues_store,
+};
+
 static struct queue_sysfs_entry queue_iostats_entry = {
 	.attr = {.name = "iostats", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_show_iostats,
@@ -386,6 +438,20 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_DEV_LAT_HIST
+static struct queue_sysfs_entry queue_queue_time_hist_entry = {
+	.attr = {.name = "queue_time_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_queue_time_hist_show,
+	.store = queue_queue_time_hist_store,
+};
+
+static struct queue_sysfs_entry queue_service_time_hist_entry = {
+	.attr = {.name = "service_time_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_service_time_hist_show,
+	.store = queue_service_time_hist_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -408,6 +474,11 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_sw_queues_entry.attr,
+#ifdef CONFIG_BLK_DEV_LAT_HIST
+	&queue_queue_time_hist_entry.attr,
+	&queue_service_time_hist_entry.attr,
+#endif
 	NULL,
 };
 
@@ -479,6 +550,8 @@ static void blk_release_queue(struct kobject *kobj)
 		__blk_queue_free_tags(q);
 
 	blk_throtl_release(q);
+	blk_lat_hist_exit(q);
+	blk_exit_sw_queues(q);
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
@@ -22,6 +22,7 @@ void blk_rq_bio_prep(struct request_queue *q, struct request *rq,
 int blk_rq_append_bio(struct request_queue *q, struct request *rq,
 		      struct bio *bio);
 void blk_drain_queue(struct request_queue *q, bool drain_all);
+void blk_exit_sw_queues(struct request_queue *q);
 void blk_dequeue_request(struct request *rq);
 void __blk_queue_free_tags(struct request_queue *q);
 bool __blk_end_bidi_request(struct request *rq, int error,
@@ -176,4 +177,25 @@ static inline void blk_throtl_exit(struct request_queue *q) { }
 static inline void blk_throtl_release(struct request_queue *q) { }
 #endif 
 
+#ifdef CONFIG_BLK_DEV_LAT_HIST
+enum {
+	BLK_LAT_QUEUE,
+	BLK_LAT_SERVICE,
+	BLK_LAT_HIST_KINDS,
+};
+
+#define BLK_LAT_BUCKETS		24
+
+extern int blk_lat_hist_init(struct request_queue *q);
+extern void blk_lat_hist_exit(struct request_queue *q);
+extern void blk_lat_hist_done(struct request *rq);
+extern ssize_t blk_lat_hist_show(struct request_queue *q, int kind,
+				 char *page);
+extern void blk_lat_hist_reset(struct request_queue *q, int kind);
+#else
+static inline int blk_lat_hist_init(struct request_queue *q) { return 0; }
+static inline void blk_lat_hist_exit(struct request_queue *q) { }
+static inline void blk_lat_hist_done(struct request *rq) { }
+#endif
+
 #endif 
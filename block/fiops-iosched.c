@@ -23,6 +23,9 @@
 
 #define VIOS_PRIO_SCALE (5)
 
+#define FIOPS_BATCH_REQUESTS (4)
+#define FIOPS_BATCH_BYTES (128 * 1024)
+
 struct fiops_rb_root {
 	struct rb_root rb;
 	struct rb_node *left;
@@ -53,6 +56,20 @@ struct fiops_data {
 	unsigned int write_scale;
 	unsigned int sync_scale;
 	unsigned int async_scale;
+
+	/*
+	 * The active ioc keeps dispatching until it has used up batch_requests
+	 * requests or batch_bytes bytes, and is only then charged the vios of
+	 * the whole batch and resorted in the service tree.
+	 */
+	struct fiops_ioc *active_ioc;
+	unsigned int active_requests;
+	unsigned int active_bytes;
+	u64 active_vios;
+	sector_t active_next_sector;
+
+	unsigned int batch_requests;
+	unsigned int batch_bytes;
 };
 
 struct fiops_ioc {
@@ -338,13 +355,10 @@ static u64 fiops_scaled_vios(struct fiops_data *fiopsd,
 
 /* return vios dispatched */
 static u64 fiops_dispatch_request(struct fiops_data *fiopsd,
-	struct fiops_ioc *ioc)
+	struct fiops_ioc *ioc, struct request *rq)
 {
-	struct request *rq;
 	struct request_queue *q = fiopsd->queue;
 
-	rq = rq_entry_fifo(ioc->fifo.next);
-
 	fiops_remove_request(rq);
 	elv_dispatch_add_tail(q, rq);
 
@@ -365,7 +379,8 @@ static int fiops_forced_dispatch(struct fiops_data *fiopsd)
 			ioc = fiops_rb_first(&fiopsd->service_tree[i]);
 
 			while (!list_empty(&ioc->fifo)) {
-				fiops_dispatch_request(fiopsd, ioc);
+				fiops_dispatch_request(fiopsd, ioc,
+					rq_entry_fifo(ioc->fifo.next));
 				dispatched++;
 			}
 			if (fiops_ioc_on_rr(ioc))
@@ -421,28 +436,140 @@ static void fiops_charge_vios(struct fiops_data *fiopsd,
 
 	if (RB_EMPTY_ROOT(&ioc->sort_list))
 		fiops_del_ioc_rr(fiopsd, ioc);
-	else
+	else if (fiopsd->busy_queues > 1 || service_tree->count != 1 ||
+		 service_tree != ioc_service_tree(ioc))
 		fiops_resort_rr_list(fiopsd, ioc);
+	/* else the only busy ioc stays where it is, nothing to resort */
 
 	fiops_update_min_vios(service_tree);
 }
 
+/*
+ * Charge the active ioc for the requests dispatched in its batch.
+ */
+static void fiops_end_batch(struct fiops_data *fiopsd)
+{
+	struct fiops_ioc *ioc = fiopsd->active_ioc;
+
+	if (!ioc)
+		return;
+
+	fiops_log_ioc(fiopsd, ioc, "end batch, %u requests %u bytes",
+		fiopsd->active_requests, fiopsd->active_bytes);
+
+	fiopsd->active_ioc = NULL;
+	fiops_charge_vios(fiopsd, ioc, fiopsd->active_vios);
+}
+
+/*
+ * The only busy ioc has no batch limit, so charge it as it goes. Otherwise
+ * service_tree->min_vios stays behind, an ioc that becomes busy later is
+ * placed far ahead of it, and once its batch ends it is charged for all
+ * the time it ran alone.
+ */
+static void fiops_charge_batch(struct fiops_data *fiopsd,
+	struct fiops_ioc *ioc)
+{
+	ioc->vios += fiopsd->active_vios;
+	fiopsd->active_vios = 0;
+
+	fiops_update_min_vios(ioc->service_tree);
+}
+
+static void fiops_start_batch(struct fiops_data *fiopsd, struct fiops_ioc *ioc)
+{
+	fiopsd->active_ioc = ioc;
+	fiopsd->active_requests = 0;
+	fiopsd->active_bytes = 0;
+	fiopsd->active_vios = 0;
+	fiopsd->active_next_sector = 0;
+}
+
+/*
+ * Keep dispatching from the active ioc as long as its batch isn't used up.
+ * The limits don't matter if nobody else is waiting, in which case the
+ * ioc is charged per request, but a busy ioc of a higher priority class
+ * always ends the batch.
+ */
+static bool fiops_continue_batch(struct fiops_data *fiopsd)
+{
+	struct fiops_ioc *ioc = fiopsd->active_ioc;
+	struct request *rq;
+	int i;
+
+	if (!ioc || !fiops_ioc_on_rr(ioc))
+		return false;
+
+	for (i = RT_WORKLOAD; i > ioc->wl_type; i--)
+		if (!RB_EMPTY_ROOT(&fiopsd->service_tree[i].rb))
+			return false;
+
+	/* let fiops_select_ioc() decide whether to postpone async requests */
+	rq = rq_entry_fifo(ioc->fifo.next);
+	if (!rq_is_sync(rq) && fiopsd->in_flight[1] != 0)
+		return false;
+
+	if (fiopsd->busy_queues == 1)
+		return true;
+
+	return fiopsd->active_requests < fiopsd->batch_requests &&
+		fiopsd->active_bytes < fiopsd->batch_bytes;
+}
+
+/*
+ * Within a batch prefer the request that continues where the previous one
+ * ended, so that sequential streams reach the device back to back.
+ */
+static struct request *fiops_batch_next_request(struct fiops_data *fiopsd,
+	struct fiops_ioc *ioc)
+{
+	struct request *rq;
+
+	if (fiopsd->active_requests) {
+		rq = elv_rb_find(&ioc->sort_list, fiopsd->active_next_sector);
+		if (rq)
+			return rq;
+	}
+
+	return rq_entry_fifo(ioc->fifo.next);
+}
+
 static int fiops_dispatch_requests(struct request_queue *q, int force)
 {
 	struct fiops_data *fiopsd = q->elevator->elevator_data;
 	struct fiops_ioc *ioc;
-	u64 vios;
+	struct request *rq;
 
-	if (unlikely(force))
+	if (unlikely(force)) {
+		fiops_end_batch(fiopsd);
 		return fiops_forced_dispatch(fiopsd);
+	}
 
-	ioc = fiops_select_ioc(fiopsd);
-	if (!ioc)
-		return 0;
+	if (fiops_continue_batch(fiopsd))
+		ioc = fiopsd->active_ioc;
+	else {
+		fiops_end_batch(fiopsd);
+
+		ioc = fiops_select_ioc(fiopsd);
+		if (!ioc)
+			return 0;
+
+		fiops_start_batch(fiopsd, ioc);
+	}
+
+	rq = fiops_batch_next_request(fiopsd, ioc);
 
-	vios = fiops_dispatch_request(fiopsd, ioc);
+	fiopsd->active_requests++;
+	fiopsd->active_bytes += blk_rq_bytes(rq);
+	fiopsd->active_next_sector = blk_rq_pos(rq) + blk_rq_sectors(rq);
+	fiopsd->active_vios += fiops_dispatch_request(fiopsd, ioc, rq);
+
+	/* an empty ioc leaves the service tree right away */
+	if (RB_EMPTY_ROOT(&ioc->sort_list))
+		fiops_end_batch(fiopsd);
+	else if (fiopsd->busy_queues == 1)
+		fiops_charge_batch(fiopsd, ioc);
 
-	fiops_charge_vios(fiopsd, ioc, vios);
 	return 1;
 }
 
@@ -575,8 +702,12 @@ fiops_merged_requests(struct request_queue *q, struct request *rq,
 	 * all requests of this task are merged to other tasks, delete it
 	 * from the service tree.
 	 */
-	if (fiops_ioc_on_rr(ioc) && RB_EMPTY_ROOT(&ioc->sort_list))
-		fiops_del_ioc_rr(fiopsd, ioc);
+	if (fiops_ioc_on_rr(ioc) && RB_EMPTY_ROOT(&ioc->sort_list)) {
+		if (ioc == fiopsd->active_ioc)
+			fiops_end_batch(fiopsd);
+		else
+			fiops_del_ioc_rr(fiopsd, ioc);
+	}
 }
 
 static int fiops_allow_merge(struct request_queue *q, struct request *rq,
@@ -635,6 +766,9 @@ static void *fiops_init_queue(struct request_queue *q)
 	fiopsd->sync_scale = VIOS_SYNC_SCALE;
 	fiopsd->async_scale = VIOS_ASYNC_SCALE;
 
+	fiopsd->batch_requests = FIOPS_BATCH_REQUESTS;
+	fiopsd->batch_bytes = FIOPS_BATCH_BYTES;
+
 	return fiopsd;
 }
 
@@ -681,6 +815,8 @@ SHOW_FUNCTION(fiops_read_scale_show, fiopsd->read_scale);
 SHOW_FUNCTION(fiops_write_scale_show, fiopsd->write_scale);
 SHOW_FUNCTION(fiops_sync_scale_show, fiopsd->sync_scale);
 SHOW_FUNCTION(fiops_async_scale_show, fiopsd->async_scale);
+SHOW_FUNCTION(fiops_batch_requests_show, fiopsd->batch_requests);
+SHOW_FUNCTION(fiops_batch_bytes_show, fiopsd->batch_bytes);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
@@ -700,6 +836,8 @@ STORE_FUNCTION(fiops_read_scale_store, &fiopsd->read_scale, 1, 100);
 STORE_FUNCTION(fiops_write_scale_store, &fiopsd->write_scale, 1, 100);
 STORE_FUNCTION(fiops_sync_scale_store, &fiopsd->sync_scale, 1, 100);
 STORE_FUNCTION(fiops_async_scale_store, &fiopsd->async_scale, 1, 100);
+STORE_FUNCTION(fiops_batch_requests_store, &fiopsd->batch_requests, 1, 128);
+STORE_FUNCTION(fiops_batch_bytes_store, &fiopsd->batch_bytes, 4096, 4 * 1024 * 1024);
 #undef STORE_FUNCTION
 
 #define FIOPS_ATTR(name) \
@@ -710,6 +848,8 @@ static struct elv_fs_entry fiops_attrs[] = {
 	FIOPS_ATTR(write_scale),
 	FIOPS_ATTR(sync_scale),
 	FIOPS_ATTR(async_scale),
+	FIOPS_ATTR(batch_requests),
+	FIOPS_ATTR(batch_bytes),
 	__ATTR_NULL
 };
 
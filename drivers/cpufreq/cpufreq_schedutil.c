@@ -0,0 +1,380 @@
+/*
+ *  drivers/cpufreq/cpufreq_schedutil.c
+ *
+ *  Frequency selection driven by scheduler utilization.
+ *
+ *  Instead of sampling idle time from a timer, the governor is called by
+ *  the scheduler on enqueue, dequeue and tick with the cpu's tracked
+ *  utilization, and picks the frequency that would run it at ~80% busy.
+ *  The tracked utilization is not scaled by frequency, it is the busy
+ *  fraction at the current speed, so:
+ *
+ *	next_freq = 1.25 * policy->cur * util / max
+ *
+ *  RT tasks pass util == ULONG_MAX and get the maximum speed.
+ *
+ *  The callback runs under the rq lock, so the actual frequency change is
+ *  handed to a SCHED_FIFO kthread through an irq_work. Requests are rate
+ *  limited separately for going up and for going down.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpu.h>
+#include <linux/irq_work.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/jiffies.h>
+
+#define DEF_UP_RATE_LIMIT_US		(500)
+#define DEF_DOWN_RATE_LIMIT_US		(20000)
+
+struct sugov_policy {
+	struct cpufreq_policy *policy;
+
+	raw_spinlock_t update_lock;
+	u64 last_freq_update_time;
+	unsigned int next_freq;
+	bool work_in_progress;
+
+	struct irq_work irq_work;
+	struct kthread_work work;
+	struct mutex work_lock;
+	struct kthread_worker worker;
+	struct task_struct *thread;
+};
+
+struct sugov_cpu {
+	struct update_util_data update_util;
+	struct sugov_policy *sg_policy;
+	unsigned long util;
+	unsigned long max;
+	u64 last_update;
+};
+static DEFINE_PER_CPU(struct sugov_cpu, sugov_cpu);
+
+static DEFINE_MUTEX(sugov_mutex);
+static unsigned int sugov_enable;
+
+static struct sugov_tuners {
+	unsigned int up_rate_limit_us;
+	unsigned int down_rate_limit_us;
+} sugov_tuners_ins = {
+	.up_rate_limit_us = DEF_UP_RATE_LIMIT_US,
+	.down_rate_limit_us = DEF_DOWN_RATE_LIMIT_US,
+};
+
+static unsigned int get_next_freq(struct cpufreq_policy *policy,
+				  unsigned long util, unsigned long max)
+{
+	u64 freq = policy->cur;
+
+	if (util == ULONG_MAX)
+		return policy->max;
+
+	freq = div_u64((freq + (freq >> 2)) * util, max);
+
+	return clamp_t(unsigned int, freq, policy->min, policy->max);
+}
+
+/* the busiest cpu of the policy that was not idle for more than a tick */
+static unsigned int sugov_next_freq_shared(struct sugov_policy *sg_policy,
+					   u64 time)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+	unsigned long util = 0, max = 1;
+	unsigned int j;
+
+	for_each_cpu(j, policy->cpus) {
+		struct sugov_cpu *j_sg_cpu = &per_cpu(sugov_cpu, j);
+		s64 delta_ns = time - j_sg_cpu->last_update;
+
+		if (j_sg_cpu->sg_policy != sg_policy ||
+		    delta_ns > (s64)TICK_NSEC)
+			continue;
+
+		if (j_sg_cpu->util == ULONG_MAX)
+			return policy->max;
+
+		if (j_sg_cpu->util * max > util * j_sg_cpu->max) {
+			util = j_sg_cpu->util;
+			max = j_sg_cpu->max;
+		}
+	}
+
+	return get_next_freq(policy, util, max);
+}
+
+static void sugov_update(struct update_util_data *data, u64 time,
+			 unsigned long util, unsigned long max)
+{
+	struct sugov_cpu *sg_cpu = container_of(data, struct sugov_cpu,
+						update_util);
+	struct sugov_policy *sg_policy = sg_cpu->sg_policy;
+	unsigned int next_f;
+	s64 delta_ns;
+
+	raw_spin_lock(&sg_policy->update_lock);
+
+	sg_cpu->util = util == ULONG_MAX ? util : min(util, max);
+	sg_cpu->max = max;
+	sg_cpu->last_update = time;
+
+	if (sg_policy->work_in_progress)
+		goto out;
+
+	delta_ns = time - sg_policy->last_freq_update_time;
+	if (delta_ns < (s64)sugov_tuners_ins.up_rate_limit_us * NSEC_PER_USEC)
+		goto out;
+
+	if (cpumask_weight(sg_policy->policy->cpus) > 1)
+		next_f = sugov_next_freq_shared(sg_policy, time);
+	else
+		next_f = get_next_freq(sg_policy->policy, sg_cpu->util, max);
+
+	if (next_f == sg_policy->next_freq)
+		goto out;
+
+	if (next_f < sg_policy->next_freq && delta_ns <
+	    (s64)sugov_tuners_ins.down_rate_limit_us * NSEC_PER_USEC)
+		goto out;
+
+	sg_policy->next_freq = next_f;
+	sg_policy->last_freq_update_time = time;
+	sg_policy->work_in_progress = true;
+	irq_work_queue(&sg_policy->irq_work);
+out:
+	raw_spin_unlock(&sg_policy->update_lock);
+}
+
+static void sugov_work(struct kthread_work *work)
+{
+	struct sugov_policy *sg_policy = container_of(work, struct sugov_policy,
+						      work);
+
+	mutex_lock(&sg_policy->work_lock);
+	__cpufreq_driver_target(sg_policy->policy, sg_policy->next_freq,
+				CPUFREQ_RELATION_L);
+	mutex_unlock(&sg_policy->work_lock);
+
+	sg_policy->work_in_progress = false;
+}
+
+static void sugov_irq_work(struct irq_work *irq_work)
+{
+	struct sugov_policy *sg_policy = container_of(irq_work,
+						      struct sugov_policy,
+						      irq_work);
+
+	queue_kthread_work(&sg_policy->worker, &sg_policy->work);
+}
+
+#define show_one(file_name, object)					\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%u\n", sugov_tuners_ins.object);		\
+}
+show_one(up_rate_limit_us, up_rate_limit_us);
+show_one(down_rate_limit_us, down_rate_limit_us);
+
+static ssize_t store_up_rate_limit_us(struct kobject *a, struct attribute *b,
+				      const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	sugov_tuners_ins.up_rate_limit_us = input;
+	return count;
+}
+
+static ssize_t store_down_rate_limit_us(struct kobject *a, struct attribute *b,
+					const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	sugov_tuners_ins.down_rate_limit_us = input;
+	return count;
+}
+
+define_one_global_rw(up_rate_limit_us);
+define_one_global_rw(down_rate_limit_us);
+
+static struct attribute *sugov_attributes[] = {
+	&up_rate_limit_us.attr,
+	&down_rate_limit_us.attr,
+	NULL
+};
+
+static struct attribute_group sugov_attr_group = {
+	.attrs = sugov_attributes,
+	.name = "schedutil",
+};
+
+static int sugov_start(struct cpufreq_policy *policy)
+{
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	struct sugov_policy *sg_policy;
+	unsigned int j;
+	int rc;
+
+	if (!cpu_online(policy->cpu) || !policy->cur)
+		return -EINVAL;
+
+	sg_policy = kzalloc(sizeof(*sg_policy), GFP_KERNEL);
+	if (!sg_policy)
+		return -ENOMEM;
+
+	sg_policy->policy = policy;
+	sg_policy->next_freq = policy->cur;
+	raw_spin_lock_init(&sg_policy->update_lock);
+	mutex_init(&sg_policy->work_lock);
+	init_irq_work(&sg_policy->irq_work, sugov_irq_work);
+	init_kthread_work(&sg_policy->work, sugov_work);
+	init_kthread_worker(&sg_policy->worker);
+
+	sg_policy->thread = kthread_create(kthread_worker_fn, &sg_policy->worker,
+					   "sugov:%u", policy->cpu);
+	if (IS_ERR(sg_policy->thread)) {
+		rc = PTR_ERR(sg_policy->thread);
+		kfree(sg_policy);
+		return rc;
+	}
+	sched_setscheduler(sg_policy->thread, SCHED_FIFO, &param);
+	wake_up_process(sg_policy->thread);
+
+	mutex_lock(&sugov_mutex);
+	if (!sugov_enable) {
+		rc = sysfs_create_group(cpufreq_global_kobject,
+					&sugov_attr_group);
+		if (rc) {
+			mutex_unlock(&sugov_mutex);
+			kthread_stop(sg_policy->thread);
+			kfree(sg_policy);
+			return rc;
+		}
+	}
+	sugov_enable++;
+	mutex_unlock(&sugov_mutex);
+
+	for_each_cpu(j, policy->cpus) {
+		struct sugov_cpu *j_sg_cpu = &per_cpu(sugov_cpu, j);
+
+		memset(j_sg_cpu, 0, sizeof(*j_sg_cpu));
+		j_sg_cpu->sg_policy = sg_policy;
+		j_sg_cpu->update_util.func = sugov_update;
+		cpufreq_set_update_util_data(j, &j_sg_cpu->update_util);
+	}
+
+	return 0;
+}
+
+static void sugov_stop(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = per_cpu(sugov_cpu, policy->cpu).sg_policy;
+	unsigned int j;
+
+	if (!sg_policy)
+		return;
+
+	for_each_possible_cpu(j)
+		if (per_cpu(sugov_cpu, j).sg_policy == sg_policy)
+			cpufreq_set_update_util_data(j, NULL);
+
+	synchronize_sched();
+
+	for_each_possible_cpu(j)
+		if (per_cpu(sugov_cpu, j).sg_policy == sg_policy)
+			per_cpu(sugov_cpu, j).sg_policy = NULL;
+
+	irq_work_sync(&sg_policy->irq_work);
+	flush_kthread_worker(&sg_policy->worker);
+	kthread_stop(sg_policy->thread);
+
+	mutex_lock(&sugov_mutex);
+	if (!--sugov_enable)
+		sysfs_remove_group(cpufreq_global_kobject, &sugov_attr_group);
+	mutex_unlock(&sugov_mutex);
+
+	kfree(sg_policy);
+}
+
+static void sugov_limits(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = per_cpu(sugov_cpu, policy->cpu).sg_policy;
+
+	if (!sg_policy)
+		return;
+
+	mutex_lock(&sg_policy->work_lock);
+	if (policy->max < policy->cur)
+		__cpufreq_driver_target(policy, policy->max, CPUFREQ_RELATION_H);
+	else if (policy->min > policy->cur)
+		__cpufreq_driver_target(policy, policy->min, CPUFREQ_RELATION_L);
+	mutex_unlock(&sg_policy->work_lock);
+}
+
+static int cpufreq_governor_schedutil(struct cpufreq_policy *policy,
+				      unsigned int event)
+{
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		return sugov_start(policy);
+
+	case CPUFREQ_GOV_STOP:
+		sugov_stop(policy);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		sugov_limits(policy);
+		break;
+	}
+	return 0;
+}
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL
+static
+#endif
+struct cpufreq_governor cpufreq_gov_schedutil = {
+	.name			= "schedutil",
+	.governor		= cpufreq_governor_schedutil,
+	.owner			= THIS_MODULE,
+};
+
+static int __init cpufreq_gov_schedutil_init(void)
+{
+	return cpufreq_register_governor(&cpufreq_gov_schedutil);
+}
+
+static void __exit cpufreq_gov_schedutil_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_schedutil);
+}
+
+MODULE_DESCRIPTION("'cpufreq_schedutil' - A cpufreq governor driven by "
+	"scheduler utilization updates");
+MODULE_LICENSE("GPL");
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL
+fs_initcall(cpufreq_gov_schedutil_init);
+#else
+module_init(cpufreq_gov_schedutil_init);
+#endif
+module_exit(cpufreq_gov_schedutil_exit);
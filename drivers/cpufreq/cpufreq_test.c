@@ -0,0 +1,183 @@
+/*
+ *  drivers/cpufreq/cpufreq_test.c
+ *
+ *  A cpufreq driver that changes nothing, for benchmarking governors on
+ *  machines without (or with an unloaded) real cpufreq driver.
+ *
+ *  Every cpu gets its own policy with an eight step table. A transition
+ *  only sleeps for transition_delay_us and records the new frequency, so
+ *  governors and the transition notifiers see the same calls as on real
+ *  hardware.
+ *
+ *  To measure how fast a governor ramps up, write to the ramp_test file of
+ *  a policy and immediately start loading its cpu, e.g.
+ *
+ *	cd /sys/devices/system/cpu/cpu1/cpufreq
+ *	taskset -c 1 sh -c 'echo 1 > ramp_test; while :; do :; done'
+ *
+ *  ramp_test then reads back the time, in usecs, from the write until the
+ *  policy first reached scaling_max_freq, or -1 while it has not.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+
+static unsigned int transition_delay_us = 50;
+module_param(transition_delay_us, uint, 0644);
+MODULE_PARM_DESC(transition_delay_us, "Emulated transition time in usecs");
+
+static struct cpufreq_frequency_table test_freq_table[] = {
+	{ 0,  300000 },
+	{ 1,  600000 },
+	{ 2,  900000 },
+	{ 3, 1200000 },
+	{ 4, 1500000 },
+	{ 5, 1800000 },
+	{ 6, 2100000 },
+	{ 7, 2400000 },
+	{ 0, CPUFREQ_TABLE_END },
+};
+
+struct test_cpu {
+	unsigned int cur;
+	ktime_t ramp_start;
+	s64 ramp_us;
+	bool ramp_armed;
+};
+static DEFINE_PER_CPU(struct test_cpu, test_cpu);
+
+static int test_cpufreq_verify(struct cpufreq_policy *policy)
+{
+	return cpufreq_frequency_table_verify(policy, test_freq_table);
+}
+
+static unsigned int test_cpufreq_get(unsigned int cpu)
+{
+	return per_cpu(test_cpu, cpu).cur;
+}
+
+static int test_cpufreq_target(struct cpufreq_policy *policy,
+			       unsigned int target_freq,
+			       unsigned int relation)
+{
+	struct test_cpu *tc = &per_cpu(test_cpu, policy->cpu);
+	struct cpufreq_freqs freqs;
+	unsigned int index;
+	int ret;
+
+	ret = cpufreq_frequency_table_target(policy, test_freq_table,
+					     target_freq, relation, &index);
+	if (ret)
+		return ret;
+
+	freqs.cpu = policy->cpu;
+	freqs.old = tc->cur;
+	freqs.new = test_freq_table[index].frequency;
+	freqs.flags = 0;
+
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+
+	if (transition_delay_us)
+		usleep_range(transition_delay_us, transition_delay_us + 10);
+	tc->cur = freqs.new;
+
+	if (tc->ramp_armed && freqs.new >= policy->max) {
+		tc->ramp_us = ktime_us_delta(ktime_get(), tc->ramp_start);
+		tc->ramp_armed = false;
+	}
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+
+	return 0;
+}
+
+static int test_cpufreq_init(struct cpufreq_policy *policy)
+{
+	struct test_cpu *tc = &per_cpu(test_cpu, policy->cpu);
+	int ret;
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, test_freq_table);
+	if (ret)
+		return ret;
+
+	tc->cur = test_freq_table[0].frequency;
+	tc->ramp_us = -1;
+	tc->ramp_armed = false;
+
+	policy->cur = tc->cur;
+	policy->cpuinfo.transition_latency = transition_delay_us * 1000;
+	cpufreq_frequency_table_get_attr(test_freq_table, policy->cpu);
+
+	return 0;
+}
+
+static int test_cpufreq_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+	return 0;
+}
+
+static ssize_t show_ramp_test(struct cpufreq_policy *policy, char *buf)
+{
+	return sprintf(buf, "%lld\n", per_cpu(test_cpu, policy->cpu).ramp_us);
+}
+
+static ssize_t store_ramp_test(struct cpufreq_policy *policy,
+			       const char *buf, size_t count)
+{
+	struct test_cpu *tc = &per_cpu(test_cpu, policy->cpu);
+
+	tc->ramp_us = -1;
+	tc->ramp_start = ktime_get();
+	tc->ramp_armed = true;
+
+	return count;
+}
+
+cpufreq_freq_attr_rw(ramp_test);
+
+static struct freq_attr *test_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	&ramp_test,
+	NULL,
+};
+
+static struct cpufreq_driver test_cpufreq_driver = {
+	.owner		= THIS_MODULE,
+	.name		= "cpufreq-test",
+	.verify		= test_cpufreq_verify,
+	.target		= test_cpufreq_target,
+	.get		= test_cpufreq_get,
+	.init		= test_cpufreq_init,
+	.exit		= test_cpufreq_exit,
+	.attr		= test_cpufreq_attr,
+};
+
+static int __init test_cpufreq_module_init(void)
+{
+	return cpufreq_register_driver(&test_cpufreq_driver);
+}
+
+static void __exit test_cpufreq_module_exit(void)
+{
+	cpufreq_unregister_driver(&test_cpufreq_driver);
+}
+
+MODULE_DESCRIPTION("Test cpufreq driver for governor benchmarking");
+MODULE_LICENSE("GPL");
+
+module_init(test_cpufreq_module_init);
+module_exit(test_cpufreq_module_exit);
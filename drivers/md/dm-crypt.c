@@ -8,6 +8,7 @@
 
 #include <linux/completion.h>
 #include <linux/err.h>
+#include <linux/cpu.h>
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
@@ -18,7 +19,9 @@
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
 #include <linux/backing-dev.h>
+#include <linux/kthread.h>
 #include <linux/atomic.h>
+#include <linux/rbtree.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
 #include <asm/unaligned.h>
@@ -38,6 +41,7 @@ struct convert_context {
 	unsigned int offset_out;
 	unsigned int idx_in;
 	unsigned int idx_out;
+	unsigned int idx_in_end;
 	sector_t sector;
 	atomic_t cc_pending;
 	struct ablkcipher_request *req;
@@ -54,6 +58,13 @@ struct dm_crypt_io {
 	int error;
 	sector_t sector;
 	struct dm_crypt_io *base_io;
+
+	/* range of base_bio handled by this io */
+	unsigned int vec_start;
+	unsigned int vec_end;
+	unsigned int size;
+
+	struct rb_node rb_node;
 };
 
 struct dm_crypt_request {
@@ -92,7 +103,8 @@ struct iv_lmk_private {
 	u8 *seed;
 };
 
-enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID };
+enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
+	     DM_CRYPT_SAME_CPU, DM_CRYPT_NO_OFFLOAD };
 
 struct crypt_config {
 	struct dm_dev *dev;
@@ -106,6 +118,11 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/* encrypted writes waiting to be submitted, sorted by sector */
+	struct task_struct *write_thread;
+	wait_queue_head_t write_thread_wait;
+	struct rb_root write_tree;
+
 	char *cipher;
 	char *cipher_string;
 
@@ -133,11 +150,13 @@ struct crypt_config {
 
 #define MIN_IOS        16
 #define MIN_POOL_PAGES 32
+#define MIN_SPLIT_SECTORS 64
 
 static struct kmem_cache *_crypt_io_pool;
 
 static void clone_init(struct dm_crypt_io *, struct bio *);
 static void kcryptd_queue_crypt(struct dm_crypt_io *io);
+static void kcryptd_crypt(struct work_struct *work);
 static u8 *iv_of_dmreq(struct crypt_config *cc, struct dm_crypt_request *dmreq);
 
 static struct crypto_ablkcipher *any_tfm(struct crypt_config *cc)
@@ -563,6 +582,7 @@ static void crypt_convert_init(struct crypt_config *cc,
 	ctx->offset_out = 0;
 	ctx->idx_in = bio_in ? bio_in->bi_idx : 0;
 	ctx->idx_out = bio_out ? bio_out->bi_idx : 0;
+	ctx->idx_in_end = bio_in ? bio_in->bi_vcnt : 0;
 	ctx->sector = sector + cc->iv_offset;
 	init_completion(&ctx->restart);
 }
@@ -665,7 +685,7 @@ static int crypt_convert(struct crypt_config *cc,
 
 	atomic_set(&ctx->cc_pending, 1);
 
-	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
+	while(ctx->idx_in < ctx->idx_in_end &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
 		crypt_alloc_req(cc, ctx);
@@ -767,24 +787,37 @@ static void crypt_free_buffer_pages(struct crypt_config *cc, struct bio *clone)
 	}
 }
 
-static struct dm_crypt_io *crypt_io_alloc(struct dm_target *ti,
-					  struct bio *bio, sector_t sector)
+static struct dm_crypt_io *__crypt_io_alloc(struct dm_target *ti,
+					    struct bio *bio, sector_t sector,
+					    gfp_t gfp_mask)
 {
 	struct crypt_config *cc = ti->private;
 	struct dm_crypt_io *io;
 
-	io = mempool_alloc(cc->io_pool, GFP_NOIO);
+	io = mempool_alloc(cc->io_pool, gfp_mask);
+	if (!io)
+		return NULL;
+
 	io->target = ti;
 	io->base_bio = bio;
 	io->sector = sector;
 	io->error = 0;
 	io->base_io = NULL;
+	io->vec_start = bio->bi_idx;
+	io->vec_end = bio->bi_vcnt;
+	io->size = bio->bi_size;
 	io->ctx.req = NULL;
 	atomic_set(&io->io_pending, 0);
 
 	return io;
 }
 
+static struct dm_crypt_io *crypt_io_alloc(struct dm_target *ti,
+					  struct bio *bio, sector_t sector)
+{
+	return __crypt_io_alloc(ti, bio, sector, GFP_NOIO);
+}
+
 static void crypt_inc_pending(struct dm_crypt_io *io)
 {
 	atomic_inc(&io->io_pending);
@@ -900,10 +933,75 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
+#define crypt_io_from_node(node) rb_entry((node), struct dm_crypt_io, rb_node)
+
+/*
+ * Encrypted writes finish on whichever CPU happened to convert them, so
+ * they reach the block layer out of order.  Queue them in an rbtree sorted
+ * by sector and let a single thread submit each batch under one plug, so
+ * that the elevator sees them in order again.
+ */
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct dm_crypt_io *io;
+
+	while (1) {
+		struct rb_root write_tree;
+		struct blk_plug plug;
+
+		DECLARE_WAITQUEUE(wait, current);
+
+		spin_lock_irq(&cc->write_thread_wait.lock);
+continue_locked:
+
+		if (!RB_EMPTY_ROOT(&cc->write_tree))
+			goto pop_from_list;
+
+		__set_current_state(TASK_INTERRUPTIBLE);
+		__add_wait_queue(&cc->write_thread_wait, &wait);
+
+		spin_unlock_irq(&cc->write_thread_wait.lock);
+
+		if (unlikely(kthread_should_stop())) {
+			set_task_state(current, TASK_RUNNING);
+			remove_wait_queue(&cc->write_thread_wait, &wait);
+			break;
+		}
+
+		schedule();
+
+		set_task_state(current, TASK_RUNNING);
+		spin_lock_irq(&cc->write_thread_wait.lock);
+		__remove_wait_queue(&cc->write_thread_wait, &wait);
+		goto continue_locked;
+
+pop_from_list:
+		write_tree = cc->write_tree;
+		cc->write_tree = RB_ROOT;
+		spin_unlock_irq(&cc->write_thread_wait.lock);
+
+		BUG_ON(rb_parent(write_tree.rb_node));
+
+		blk_start_plug(&plug);
+		do {
+			io = crypt_io_from_node(rb_first(&write_tree));
+			rb_erase(&io->rb_node, &write_tree);
+			kcryptd_io_write(io);
+		} while (!RB_EMPTY_ROOT(&write_tree));
+		blk_finish_plug(&plug);
+	}
+
+	return 0;
+}
+
 static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 {
 	struct bio *clone = io->ctx.bio_out;
 	struct crypt_config *cc = io->target->private;
+	unsigned long flags;
+	sector_t sector;
+	struct rb_node **rbp, *parent;
 
 	if (unlikely(io->error < 0)) {
 		crypt_free_buffer_pages(cc, clone);
@@ -917,10 +1015,103 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
-		kcryptd_queue_io(io);
-	else
-		generic_make_request(clone);
+	if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags)) {
+		if (async)
+			kcryptd_queue_io(io);
+		else
+			generic_make_request(clone);
+		return;
+	}
+
+	spin_lock_irqsave(&cc->write_thread_wait.lock, flags);
+	rbp = &cc->write_tree.rb_node;
+	parent = NULL;
+	sector = io->sector;
+	while (*rbp) {
+		parent = *rbp;
+		if (sector < crypt_io_from_node(parent)->sector)
+			rbp = &(*rbp)->rb_left;
+		else
+			rbp = &(*rbp)->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, rbp);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+
+	wake_up_locked(&cc->write_thread_wait);
+	spin_unlock_irqrestore(&cc->write_thread_wait.lock, flags);
+}
+
+/*
+ * Split the front of a large bio along bio_vec boundaries into pieces for
+ * the crypt workers of the other online CPUs, and leave the rest in @io to
+ * be converted by the caller on this CPU.  Each piece holds a reference on
+ * @io, so the base bio is still completed exactly once.
+ *
+ * This runs in a crypt worker, so pieces must not wait for io_pool: the
+ * elements they would wait for may be held by ios queued behind this very
+ * worker.  When the pool is empty, the remainder is simply converted here.
+ */
+static void kcryptd_crypt_split(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	struct bio *base_bio = io->base_bio;
+	struct dm_crypt_io *piece;
+	struct bio_vec *bv;
+	sector_t sector = io->sector;
+	unsigned int nr_pieces, piece_size, size, idx;
+	int cpu;
+
+	if (io->base_io || test_bit(DM_CRYPT_SAME_CPU, &cc->flags))
+		return;
+
+	get_online_cpus();
+
+	nr_pieces = min_t(unsigned int, num_online_cpus(),
+			  (io->size >> SECTOR_SHIFT) / MIN_SPLIT_SECTORS);
+	if (nr_pieces < 2) {
+		put_online_cpus();
+		return;
+	}
+	piece_size = io->size / nr_pieces;
+
+	idx = io->vec_start;
+	cpu = raw_smp_processor_id();
+	while (--nr_pieces && idx + 1 < io->vec_end) {
+		piece = __crypt_io_alloc(io->target, base_bio, sector,
+					 GFP_NOWAIT);
+		if (!piece)
+			break;
+		piece->base_io = io;
+		piece->vec_start = idx;
+
+		size = 0;
+		do {
+			bv = bio_iovec_idx(base_bio, idx++);
+			size += bv->bv_len;
+		} while (idx + 1 < io->vec_end && size < piece_size);
+
+		piece->vec_end = idx;
+		piece->size = size;
+		sector += size >> SECTOR_SHIFT;
+		io->size -= size;
+
+		/* a read piece also holds the reference of the data clone */
+		if (bio_data_dir(base_bio) == READ)
+			crypt_inc_pending(piece);
+		crypt_inc_pending(io);
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+
+		INIT_WORK(&piece->work, kcryptd_crypt);
+		queue_work_on(cpu, cc->crypt_queue, &piece->work);
+	}
+
+	put_online_cpus();
+
+	io->vec_start = idx;
+	io->sector = sector;
 }
 
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
@@ -929,13 +1120,21 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 	struct bio *clone;
 	struct dm_crypt_io *new_io;
 	int crypt_finished;
+	int offload = !test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
 	unsigned out_of_pages = 0;
-	unsigned remaining = io->base_bio->bi_size;
-	sector_t sector = io->sector;
+	unsigned remaining;
+	sector_t sector;
 	int r;
 
 	crypt_inc_pending(io);
+
+	kcryptd_crypt_split(io);
+	remaining = io->size;
+	sector = io->sector;
+
 	crypt_convert_init(cc, &io->ctx, NULL, io->base_bio, sector);
+	io->ctx.idx_in = io->vec_start;
+	io->ctx.idx_in_end = io->vec_end;
 
 	while (remaining) {
 		clone = crypt_alloc_buffer(io, remaining, &out_of_pages);
@@ -964,19 +1163,22 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			if (unlikely(r < 0))
 				break;
 
-			io->sector = sector;
+			/* a queued io belongs to the write thread now */
+			if (!offload)
+				io->sector = sector;
 		}
 
 		if (unlikely(out_of_pages))
 			congestion_wait(BLK_RW_ASYNC, HZ/100);
 
-		if (unlikely(!crypt_finished && remaining)) {
+		if (unlikely((!crypt_finished || offload) && remaining)) {
 			new_io = crypt_io_alloc(io->target, io->base_bio,
 						sector);
 			crypt_inc_pending(new_io);
 			crypt_convert_init(cc, &new_io->ctx, NULL,
 					   io->base_bio, sector);
 			new_io->ctx.idx_in = io->ctx.idx_in;
+			new_io->ctx.idx_in_end = io->ctx.idx_in_end;
 			new_io->ctx.offset_in = io->ctx.offset_in;
 
 			if (!io->base_io)
@@ -1006,8 +1208,12 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 
 	crypt_inc_pending(io);
 
+	kcryptd_crypt_split(io);
+
 	crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
 			   io->sector);
+	io->ctx.idx_in = io->ctx.idx_out = io->vec_start;
+	io->ctx.idx_in_end = io->vec_end;
 
 	r = crypt_convert(cc, &io->ctx);
 
@@ -1188,6 +1394,9 @@ static void crypt_dtr(struct dm_target *ti)
 	if (!cc)
 		return;
 
+	if (cc->write_thread)
+		kthread_stop(cc->write_thread);
+
 	if (cc->io_queue)
 		destroy_workqueue(cc->io_queue);
 	if (cc->crypt_queue)
@@ -1369,7 +1578,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char dummy;
 
 	static struct dm_arg _args[] = {
-		{0, 1, "Invalid number of feature args"},
+		{0, 3, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1453,15 +1662,25 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		if (ret)
 			goto bad;
 
-		opt_string = dm_shift_arg(&as);
+		while (opt_params--) {
+			opt_string = dm_shift_arg(&as);
+			if (!opt_string) {
+				ret = -EINVAL;
+				ti->error = "Not enough feature arguments";
+				goto bad;
+			}
 
-		if (opt_params == 1 && opt_string &&
-		    !strcasecmp(opt_string, "allow_discards"))
-			ti->num_discard_requests = 1;
-		else if (opt_params) {
-			ret = -EINVAL;
-			ti->error = "Invalid feature arguments";
-			goto bad;
+			if (!strcasecmp(opt_string, "allow_discards"))
+				ti->num_discard_requests = 1;
+			else if (!strcasecmp(opt_string, "same_cpu_crypt"))
+				set_bit(DM_CRYPT_SAME_CPU, &cc->flags);
+			else if (!strcasecmp(opt_string, "submit_from_crypt_cpus"))
+				set_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
+			else {
+				ret = -EINVAL;
+				ti->error = "Invalid feature arguments";
+				goto bad;
+			}
 		}
 	}
 
@@ -1485,6 +1704,21 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad;
 	}
 
+	init_waitqueue_head(&cc->write_thread_wait);
+	cc->write_tree = RB_ROOT;
+
+	if (!test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags)) {
+		cc->write_thread = kthread_create(dmcrypt_write, cc,
+						  "dmcrypt_write");
+		if (IS_ERR(cc->write_thread)) {
+			ret = PTR_ERR(cc->write_thread);
+			cc->write_thread = NULL;
+			ti->error = "Couldn't spawn write thread";
+			goto bad;
+		}
+		wake_up_process(cc->write_thread);
+	}
+
 	ti->num_flush_requests = 1;
 	ti->discard_zeroes_data_unsupported = 1;
 
@@ -1525,6 +1759,7 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 {
 	struct crypt_config *cc = ti->private;
 	unsigned i, sz = 0;
+	int num_feature_args = 0;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
@@ -1543,8 +1778,18 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
 
-		if (ti->num_discard_requests)
-			DMEMIT(" 1 allow_discards");
+		num_feature_args += !!ti->num_discard_requests;
+		num_feature_args += test_bit(DM_CRYPT_SAME_CPU, &cc->flags);
+		num_feature_args += test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
+		if (num_feature_args) {
+			DMEMIT(" %d", num_feature_args);
+			if (ti->num_discard_requests)
+				DMEMIT(" allow_discards");
+			if (test_bit(DM_CRYPT_SAME_CPU, &cc->flags))
+				DMEMIT(" same_cpu_crypt");
+			if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags))
+				DMEMIT(" submit_from_crypt_cpus");
+		}
 
 		break;
 	}
@@ -1637,7 +1882,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 11, 0},
+	.version = {1, 12, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
@@ -12,12 +12,19 @@
  * hash device. Setting this greatly improves performance when data and hash
  * are on the same disk on different partitions on devices with poor random
  * access behavior.
+ *
+ * In the file "/sys/module/dm_verity/parameters/hash_cache_size" you can set
+ * the number of bytes that each new target may use to pin the upper levels
+ * of its hash tree in memory. Levels are cached from the root down as long
+ * as they fit; a cached hash block never has to be looked up in dm-bufio or
+ * verified again once it has been read.
  */
 
 #include "dm-bufio.h"
 
 #include <linux/module.h>
 #include <linux/device-mapper.h>
+#include <linux/vmalloc.h>
 #include <crypto/hash.h>
 
 #define DM_MSG_PREFIX			"verity"
@@ -25,6 +32,9 @@
 #define DM_VERITY_IO_VEC_INLINE		16
 #define DM_VERITY_MEMPOOL_SIZE		4
 #define DM_VERITY_DEFAULT_PREFETCH_SIZE	262144
+#define DM_VERITY_DEFAULT_HASH_CACHE_SIZE	1048576
+
+#define DM_VERITY_MIN_BATCH_BLOCKS	8
 
 #define DM_VERITY_MAX_LEVELS		63
 
@@ -32,6 +42,10 @@ static unsigned dm_verity_prefetch_cluster = DM_VERITY_DEFAULT_PREFETCH_SIZE;
 
 module_param_named(prefetch_cluster, dm_verity_prefetch_cluster, uint, S_IRUGO | S_IWUSR);
 
+static unsigned dm_verity_hash_cache_size = DM_VERITY_DEFAULT_HASH_CACHE_SIZE;
+
+module_param_named(hash_cache_size, dm_verity_hash_cache_size, uint, S_IRUGO | S_IWUSR);
+
 struct dm_verity {
 	struct dm_dev *data_dev;
 	struct dm_dev *hash_dev;
@@ -62,6 +76,19 @@ struct dm_verity {
 
 	/* starting blocks for each tree level. 0 is the lowest level. */
 	sector_t hash_level_block[DM_VERITY_MAX_LEVELS];
+
+	/*
+	 * Pinned copies of verified hash blocks of the upper tree levels.
+	 * A level is cached if hash_cache[level] is non-NULL, a block of it
+	 * is valid once its bit in hash_cache_valid[level] is set.
+	 */
+	u8 *hash_cache[DM_VERITY_MAX_LEVELS];
+	unsigned long *hash_cache_valid[DM_VERITY_MAX_LEVELS];
+	size_t hash_cache_bytes;
+
+	/* hash block lookups and pinned cache hits for each tree level */
+	atomic_long_t hash_lookups[DM_VERITY_MAX_LEVELS];
+	atomic_long_t hash_hits[DM_VERITY_MAX_LEVELS];
 };
 
 struct dm_verity_io {
@@ -79,6 +106,19 @@ struct dm_verity_io {
 	struct bio_vec *io_vec;
 	unsigned io_vec_size;
 
+	/* position of the first block of this io in io_vec */
+	unsigned io_vec_start;
+	unsigned io_vec_offset;
+
+	/*
+	 * Large ios are verified in several parts on different CPUs. A part
+	 * points to the io it was split from, the io itself is ended when
+	 * the last part has dropped its "pending" reference.
+	 */
+	struct dm_verity_io *parent;
+	atomic_t pending;
+	int error;
+
 	struct work_struct work;
 
 	/* A space for short vectors; longer vectors are allocated separately. */
@@ -174,6 +214,43 @@ static void verity_hash_at_level(struct dm_verity *v, sector_t block, int level,
 		*offset = idx << (v->hash_dev_block_bits - v->hash_per_block_bits);
 }
 
+/*
+ * Return the pinned copy of a verified hash block or NULL if it isn't
+ * cached yet. The caller must check that the level is cached.
+ */
+static u8 *verity_hash_cache_block(struct dm_verity *v, sector_t hash_block,
+				   int level)
+{
+	sector_t idx = hash_block - v->hash_level_block[level];
+
+	if (!test_bit(idx, v->hash_cache_valid[level]))
+		return NULL;
+
+	/* pairs with smp_wmb() in verity_hash_cache_fill() */
+	smp_rmb();
+
+	return v->hash_cache[level] + (idx << v->hash_dev_block_bits);
+}
+
+/*
+ * Copy a verified hash block into the pinned cache. Two processes may fill
+ * the same block simultaneously, they copy the same data so this is
+ * harmless.
+ */
+static void verity_hash_cache_fill(struct dm_verity *v, sector_t hash_block,
+				   int level, u8 *data)
+{
+	sector_t idx = hash_block - v->hash_level_block[level];
+
+	if (test_bit(idx, v->hash_cache_valid[level]))
+		return;
+
+	memcpy(v->hash_cache[level] + (idx << v->hash_dev_block_bits), data,
+	       1 << v->hash_dev_block_bits);
+	smp_wmb();
+	set_bit(idx, v->hash_cache_valid[level]);
+}
+
 /*
  * Verify hash of a metadata block pertaining to the specified data block
  * ("block" argument) at a specified level ("level" argument).
@@ -198,6 +275,19 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 
 	verity_hash_at_level(v, block, level, &hash_block, &offset);
 
+	atomic_long_inc(&v->hash_lookups[level]);
+
+	if (v->hash_cache[level]) {
+		u8 *cached = verity_hash_cache_block(v, hash_block, level);
+
+		if (cached) {
+			atomic_long_inc(&v->hash_hits[level]);
+			memcpy(io_want_digest(v, io), cached + offset,
+			       v->digest_size);
+			return 0;
+		}
+	}
+
 	data = dm_bufio_read(v->bufio, hash_block, &buf);
 	if (unlikely(IS_ERR(data)))
 		return PTR_ERR(data);
@@ -260,6 +350,9 @@ static int verity_verify_level(struct dm_verity_io *io, sector_t block,
 			aux->hash_verified = 1;
 	}
 
+	if (v->hash_cache[level])
+		verity_hash_cache_fill(v, hash_block, level, data);
+
 	data += offset;
 
 	memcpy(io_want_digest(v, io), data, v->digest_size);
@@ -281,7 +374,7 @@ static int verity_verify_io(struct dm_verity_io *io)
 	struct dm_verity *v = io->v;
 	unsigned b;
 	int i;
-	unsigned vector = 0, offset = 0;
+	unsigned vector = io->io_vec_start, offset = io->io_vec_offset;
 
 	for (b = 0; b < io->n_blocks; b++) {
 		struct shash_desc *desc;
@@ -378,8 +471,11 @@ test_block_hash:
 			return -EIO;
 		}
 	}
-	BUG_ON(vector != io->io_vec_size);
-	BUG_ON(offset);
+	/* only the part that ends the io must have consumed all vectors */
+	if (!io->parent) {
+		BUG_ON(vector != io->io_vec_size);
+		BUG_ON(offset);
+	}
 
 	return 0;
 }
@@ -403,11 +499,98 @@ static void verity_finish_io(struct dm_verity_io *io, int error)
 	bio_endio(bio, error);
 }
 
+/*
+ * Drop the reference of one part of an io and end the io when it was the
+ * last one.
+ */
+static void verity_put_io(struct dm_verity_io *io, int error)
+{
+	struct dm_verity_io *parent = io->parent;
+
+	if (parent) {
+		mempool_free(io, io->v->io_mempool);
+		io = parent;
+	}
+
+	if (unlikely(error))
+		io->error = error;
+
+	if (atomic_dec_and_test(&io->pending))
+		verity_finish_io(io, io->error);
+}
+
+static void verity_work(struct work_struct *w);
+
+/*
+ * Split the leading blocks of a large io into parts that are verified by
+ * other workers of the unbound verify_wq, so that the blocks of one bio
+ * are hashed on several CPUs. The io itself keeps the trailing blocks.
+ * Parts are allocated without waiting; if the mempool is empty, the io
+ * simply verifies more blocks itself.
+ */
+static void verity_split_io(struct dm_verity_io *io)
+{
+	struct dm_verity *v = io->v;
+	unsigned parts, chunk;
+	unsigned vector = io->io_vec_start, offset = io->io_vec_offset;
+
+	parts = min_t(unsigned, num_online_cpus(),
+		      io->n_blocks / DM_VERITY_MIN_BATCH_BLOCKS);
+	if (parts < 2)
+		return;
+	chunk = io->n_blocks / parts;
+
+	while (--parts) {
+		struct dm_verity_io *part;
+		unsigned todo;
+
+		part = mempool_alloc(v->io_mempool, GFP_NOWAIT);
+		if (!part)
+			break;
+
+		part->v = v;
+		part->bio = io->bio;
+		part->block = io->block;
+		part->n_blocks = chunk;
+		part->io_vec = io->io_vec;
+		part->io_vec_size = io->io_vec_size;
+		part->io_vec_start = vector;
+		part->io_vec_offset = offset;
+		part->parent = io;
+
+		todo = chunk << v->data_dev_block_bits;
+		while (todo) {
+			struct bio_vec *bv = &io->io_vec[vector];
+			unsigned len = min(bv->bv_len - offset, todo);
+
+			offset += len;
+			if (offset == bv->bv_len) {
+				offset = 0;
+				vector++;
+			}
+			todo -= len;
+		}
+
+		io->block += chunk;
+		io->n_blocks -= chunk;
+
+		atomic_inc(&io->pending);
+		INIT_WORK(&part->work, verity_work);
+		queue_work(v->verify_wq, &part->work);
+	}
+
+	io->io_vec_start = vector;
+	io->io_vec_offset = offset;
+}
+
 static void verity_work(struct work_struct *w)
 {
 	struct dm_verity_io *io = container_of(w, struct dm_verity_io, work);
 
-	verity_finish_io(io, verity_verify_io(io));
+	if (!io->parent)
+		verity_split_io(io);
+
+	verity_put_io(io, verity_verify_io(io));
 }
 
 static void verity_end_io(struct bio *bio, int error)
@@ -493,6 +676,11 @@ static int verity_map(struct dm_target *ti, struct bio *bio,
 	io->orig_bi_private = bio->bi_private;
 	io->block = bio->bi_sector >> (v->data_dev_block_bits - SECTOR_SHIFT);
 	io->n_blocks = bio->bi_size >> v->data_dev_block_bits;
+	io->io_vec_start = 0;
+	io->io_vec_offset = 0;
+	io->parent = NULL;
+	atomic_set(&io->pending, 1);
+	io->error = 0;
 
 	bio->bi_end_io = verity_end_io;
 	bio->bi_private = io;
@@ -512,7 +700,9 @@ static int verity_map(struct dm_target *ti, struct bio *bio,
 }
 
 /*
- * Status: V (valid) or C (corruption found)
+ * Status: V (valid) or C (corruption found), followed by the size of the
+ * pinned hash cache and "<level>:<cache hits>/<lookups>" for every level,
+ * the highest level first.
  */
 static void verity_status(struct dm_target *ti, status_type_t type,
 			  char *result, unsigned maxlen)
@@ -520,10 +710,16 @@ static void verity_status(struct dm_target *ti, status_type_t type,
 	struct dm_verity *v = ti->private;
 	unsigned sz = 0;
 	unsigned x;
+	int i;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
 		DMEMIT("%c", v->hash_failed ? 'C' : 'V');
+		DMEMIT(" %zu", v->hash_cache_bytes);
+		for (i = v->levels - 1; i >= 0; i--)
+			DMEMIT(" %d:%ld/%ld", i,
+			       atomic_long_read(&v->hash_hits[i]),
+			       atomic_long_read(&v->hash_lookups[i]));
 		break;
 	case STATUSTYPE_TABLE:
 		DMEMIT("%u %s %s %u %u %llu %llu %s ",
@@ -598,6 +794,51 @@ static void verity_io_hints(struct dm_target *ti, struct queue_limits *limits)
 	blk_limits_io_min(limits, limits->logical_block_size);
 }
 
+/*
+ * Allocate the pinned hash cache for as many of the upper tree levels as
+ * fit into "hash_cache_size" bytes. The cache is filled lazily: a block is
+ * copied in the first time it has been read and verified.
+ */
+static int verity_alloc_hash_cache(struct dm_verity *v)
+{
+	size_t budget = *(volatile unsigned *)&dm_verity_hash_cache_size;
+	int i;
+
+	for (i = v->levels - 1; i >= 0; i--) {
+		sector_t end = i ? v->hash_level_block[i - 1] : v->hash_blocks;
+		sector_t n = end - v->hash_level_block[i];
+		size_t bytes = (size_t)n << v->hash_dev_block_bits;
+
+		if (n > ULONG_MAX >> v->hash_dev_block_bits ||
+		    v->hash_cache_bytes + bytes > budget)
+			break;
+
+		v->hash_cache_valid[i] = kzalloc(BITS_TO_LONGS(n) *
+						 sizeof(unsigned long),
+						 GFP_KERNEL);
+		if (!v->hash_cache_valid[i])
+			return -ENOMEM;
+
+		v->hash_cache[i] = vmalloc(bytes);
+		if (!v->hash_cache[i])
+			return -ENOMEM;
+
+		v->hash_cache_bytes += bytes;
+	}
+
+	return 0;
+}
+
+static void verity_free_hash_cache(struct dm_verity *v)
+{
+	int i;
+
+	for (i = 0; i < DM_VERITY_MAX_LEVELS; i++) {
+		vfree(v->hash_cache[i]);
+		kfree(v->hash_cache_valid[i]);
+	}
+}
+
 static void verity_dtr(struct dm_target *ti)
 {
 	struct dm_verity *v = ti->private;
@@ -614,6 +855,8 @@ static void verity_dtr(struct dm_target *ti)
 	if (v->bufio)
 		dm_bufio_client_destroy(v->bufio);
 
+	verity_free_hash_cache(v);
+
 	kfree(v->salt);
 	kfree(v->root_digest);
 
@@ -838,6 +1081,12 @@ static int verity_ctr(struct dm_target *ti, unsigned argc, char **argv)
 		goto bad;
 	}
 
+	r = verity_alloc_hash_cache(v);
+	if (r) {
+		ti->error = "Cannot allocate hash cache";
+		goto bad;
+	}
+
 	v->io_mempool = mempool_create_kmalloc_pool(DM_VERITY_MEMPOOL_SIZE,
 	  sizeof(struct dm_verity_io) + v->shash_descsize + v->digest_size * 2);
 	if (!v->io_mempool) {
@@ -872,7 +1121,7 @@ bad:
 
 static struct target_type verity_target = {
 	.name		= "verity",
-	.version	= {1, 0, 0},
+	.version	= {1, 1, 0},
 	.module		= THIS_MODULE,
 	.ctr		= verity_ctr,
 	.dtr		= verity_dtr,
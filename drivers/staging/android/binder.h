@@ -129,6 +129,32 @@ struct binder_pri_ptr_cookie {
 	void *cookie;
 };
 
+/*
+ * debugfs binder/latency holds a binder_latency_header followed by a
+ * binder_latency_record for every process (tid 0) and then one for each
+ * of its threads. queue counts the time from queueing a transaction or
+ * reply to its delivery to the target thread, reply the round trip of a
+ * synchronous transaction as seen by the caller.
+ *
+ * Bucket 0 counts times under 1us and bucket n those in [2^(n-1), 2^n)
+ * us. The last bucket also counts everything slower.
+ */
+#define BINDER_LATENCY_VERSION	1
+#define BINDER_LATENCY_BUCKETS	20
+
+struct binder_latency_header {
+	uint32_t	version;
+	uint32_t	buckets;
+	uint32_t	record_size;
+};
+
+struct binder_latency_record {
+	int32_t		pid;
+	int32_t		tid;
+	uint32_t	queue[BINDER_LATENCY_BUCKETS];
+	uint32_t	reply[BINDER_LATENCY_BUCKETS];
+};
+
 enum BinderDriverReturnProtocol {
 	BR_ERROR = _IOR('r', 0, int),
 
@@ -29,6 +29,20 @@
 
 #include <asm/ioctls.h>
 
+/*
+ * Writers reserve space by advancing w_off with cmpxchg() and copy their
+ * entry in without taking the mutex. Entries become visible to readers
+ * in the order they were reserved, as commit passes them. w_off, commit
+ * and head count bytes since the log was created; logger_offset() turns
+ * them into buffer offsets.
+ *
+ * Writers never reserve past head + size. When a writer runs out of
+ * room it takes the mutex and drops the oldest entries, LOGGER_SLACK()
+ * bytes more than it needs so that the next writes find free space
+ * without the mutex, and moves readers that pointed into the dropped
+ * entries up to the new head. Readers only look at entries between head
+ * and commit, so they never see an entry that is being written.
+ */
 struct logger_log {
 	unsigned char		*buffer;
 	struct miscdevice	misc;	
@@ -36,10 +50,16 @@ struct logger_log {
 	struct list_head	readers; 
 	struct mutex		mutex;	
 	size_t			w_off;	
+	size_t			commit;	
 	size_t			head;	
 	size_t			size;	
 };
 
+#define LOGGER_SLACK(log)	((log)->size / 16)
+
+/* Entries up to this size are gathered on the stack before writing */
+#define LOGGER_STACK_PAYLOAD	256
+
 struct logger_reader {
 	struct logger_log	*log;	
 	struct list_head	list;	
@@ -54,6 +74,15 @@ size_t logger_offset(struct logger_log *log, size_t n)
 }
 
 
+/* Offset of the end of the last complete entry */
+static size_t logger_end(struct logger_log *log)
+{
+	size_t off = logger_offset(log, ACCESS_ONCE(log->commit));
+
+	smp_rmb();
+	return off;
+}
+
 static inline struct logger_log *file_get_log(struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
@@ -154,7 +183,9 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 static size_t get_next_entry_by_uid(struct logger_log *log,
 		size_t off, uid_t euid)
 {
-	while (off != log->w_off) {
+	size_t end = logger_end(log);
+
+	while (off != end) {
 		struct logger_entry *entry;
 		struct logger_entry scratch;
 		size_t next_len;
@@ -197,7 +228,7 @@ start:
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		ret = (log->w_off == reader->r_off);
+		ret = (logger_end(log) == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -226,7 +257,7 @@ start:
 			reader->r_off, current_euid());
 
 	
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(logger_end(log) == reader->r_off)) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
@@ -248,89 +279,87 @@ out:
 	return ret;
 }
 
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
-{
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(log, off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-static inline int is_between(size_t a, size_t b, size_t c)
+/*
+ * Moves readers that point into the dropped entries between old_head and
+ * new_head up to new_head.
+ */
+static void fix_up_readers(struct logger_log *log, size_t old_head,
+			   size_t new_head)
 {
-	if (a < b) {
-		
-		if (a < c && c <= b)
-			return 1;
-	} else {
-		
-		if (c <= b || a < c)
-			return 1;
-	}
+	struct logger_reader *reader;
 
-	return 0;
+	list_for_each_entry(reader, &log->readers, list)
+		if (logger_offset(log, reader->r_off - old_head) <
+		    new_head - old_head)
+			reader->r_off = logger_offset(log, new_head);
 }
 
-static void fix_up_readers(struct logger_log *log, size_t len)
+/*
+ * Drops the oldest entries until an entry of len bytes fits after the
+ * reserved space. Only complete entries can be dropped, so the caller
+ * retries if writers that are still copying hold up the rest.
+ */
+static void logger_make_room(struct logger_log *log, size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(log, old + len);
-	struct logger_reader *reader;
-
-	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	size_t target, head, end;
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	mutex_lock(&log->mutex);
+	target = ACCESS_ONCE(log->w_off) + len + LOGGER_SLACK(log) - log->size;
+	end = ACCESS_ONCE(log->commit);
+	smp_rmb();
+	head = log->head;
+	while ((ssize_t)(target - head) > 0 && head != end)
+		head += sizeof(struct logger_entry) +
+			get_entry_msg_len(log, logger_offset(log, head));
+	if (head != log->head) {
+		fix_up_readers(log, log->head, head);
+		/* readers are out of the way before writers may reuse it */
+		smp_wmb();
+		log->head = head;
+	}
+	mutex_unlock(&log->mutex);
 }
 
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t off,
+			 const void *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	off = logger_offset(log, off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
 }
 
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static ssize_t copy_iov_from_user(void *buf, const struct iovec *iov,
+				  unsigned long nr_segs, size_t count)
 {
-	size_t len;
+	size_t copied = 0;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	while (nr_segs-- > 0 && copied < count) {
+		size_t len = min_t(size_t, iov->iov_len, count - copied);
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (copy_from_user(buf + copied, iov->iov_base, len))
 			return -EFAULT;
+		copied += len;
+		iov++;
+	}
 
-	log->w_off = logger_offset(log, log->w_off + count);
-
-	return count;
+	return copied;
 }
 
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
+	char stack_payload[LOGGER_STACK_PAYLOAD];
+	char *payload = stack_payload;
 	struct timespec now;
-	ssize_t ret = 0;
+	size_t start, len;
+	ssize_t ret;
 
 	now = current_kernel_time();
 
@@ -346,36 +375,57 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+	/*
+	 * Copy the payload in before reserving space: the entry has to be
+	 * written without sleeping once it is reserved, since every later
+	 * writer waits for it to be committed.
+	 */
+	if (header.len > sizeof(stack_payload)) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (!payload)
+			return -ENOMEM;
+	}
+	ret = copy_iov_from_user(payload, iov, nr_segs, header.len);
+	if (unlikely(ret < 0))
+		goto out;
+	header.len = ret;
+	len = sizeof(struct logger_entry) + header.len;
+
+	preempt_disable();
+	for (;;) {
+		start = ACCESS_ONCE(log->w_off);
+		if (unlikely(start + len - ACCESS_ONCE(log->head) >=
+			     log->size)) {
+			preempt_enable();
+			logger_make_room(log, len);
+			preempt_disable();
+			continue;
 		}
-
-		iov++;
-		ret += nr;
+		if (cmpxchg(&log->w_off, start, start + len) == start)
+			break;
 	}
+	/* pairs with the smp_wmb() in logger_make_room() */
+	smp_rmb();
 
-	mutex_unlock(&log->mutex);
+	do_write_log(log, start, &header, sizeof(struct logger_entry));
+	do_write_log(log, start + sizeof(struct logger_entry), payload,
+		     header.len);
 
-	
-	wake_up_interruptible(&log->wq);
+	/* publish entries in the order they were reserved */
+	while (ACCESS_ONCE(log->commit) != start)
+		cpu_relax();
+	smp_wmb();
+	log->commit = start + len;
+	preempt_enable();
+
+	/* pairs with prepare_to_wait() in logger_read() */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
+out:
+	if (payload != stack_payload)
+		kfree(payload);
 	return ret;
 }
 
@@ -409,7 +459,7 @@ static int logger_open(struct inode *inode, struct file *file)
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
+		reader->r_off = logger_offset(log, log->head);
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
 
@@ -455,7 +505,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
-	if (log->w_off != reader->r_off)
+	if (logger_end(log) != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -481,6 +531,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
+	size_t end;
 
 	mutex_lock(&log->mutex);
 
@@ -494,10 +545,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		end = logger_end(log);
+		if (end >= reader->r_off)
+			ret = end - reader->r_off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = (log->size - reader->r_off) + end;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -510,7 +562,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			reader->r_off = get_next_entry_by_uid(log,
 				reader->r_off, current_euid());
 
-		if (log->w_off != reader->r_off)
+		if (logger_end(log) != reader->r_off)
 			ret = get_user_hdr_len(reader->r_ver) +
 				get_entry_msg_len(log, reader->r_off);
 		else
@@ -521,9 +573,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
+		end = ACCESS_ONCE(log->commit);
 		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+			reader->r_off = logger_offset(log, end);
+		log->head = end;
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -574,6 +627,7 @@ static struct logger_log VAR = { \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
 	.w_off = 0, \
+	.commit = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -17,6 +17,13 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * With CONFIG_ANDROID_LOW_MEMORY_KILLER_PRESSURE the driver also measures
+ * reclaim pressure and reports it in /sys/kernel/mm/lowmemorykiller. When
+ * /sys/module/lowmemorykiller/parameters/pressure_mode is set, only the
+ * first minfree level kills while reclaim keeps up (pressure below
+ * pressure_medium). Pressure at or above pressure_critical kills from the
+ * last adj level even if no minfree level is hit.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -40,6 +47,13 @@
 #include <linux/mutex.h>
 #include <linux/delay.h>
 #include <linux/swap.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/vmstat.h>
+#include <linux/workqueue.h>
 
 #ifdef CONFIG_HIGHMEM
 	#define _ZONE ZONE_HIGHMEM
@@ -76,6 +90,7 @@ static size_t lowmem_fork_boost_minfree[6] = {
 static int lowmem_fork_boost_minfree_size = 6;
 static size_t minfree_tmp[6] = {0, 0, 0, 0, 0, 0};
 
+static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 static unsigned long lowmem_fork_boost_timeout;
 static uint32_t lowmem_fork_boost = 0;
@@ -88,22 +103,6 @@ static uint32_t lowmem_only_kswapd_sleep = 1;
 			printk(x);			\
 	} while (0)
 
-static int test_task_flag(struct task_struct *p, int flag)
-{
-	struct task_struct *t;
-
-	for_each_thread(p,t) {
-		task_lock(t);
-		if (test_tsk_thread_flag(t, flag)) {
-			task_unlock(t);
-			return 1;
-		}
-		task_unlock(t);
-	}
-
-	return 0;
-}
-
 static int
 task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -119,6 +118,25 @@ task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data
 	return NOTIFY_OK;
 }
 
+/*
+ * lowmem_deathpending is only compared against, never dereferenced, so it
+ * is enough to clear it once the victim's task_struct goes away.
+ */
+static int
+task_free_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+
+	if (task == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block task_free_nb = {
+	.notifier_call = task_free_notify_func,
+};
+
 static void dump_tasks(void)
 {
 	struct task_struct *p;
@@ -139,12 +157,304 @@ static void dump_tasks(void)
 	}
 }
 
+/*
+ * Processes are kept on one list per range of oom_score_adj values, so
+ * that picking a victim only walks the buckets at or above min_score_adj
+ * instead of every process in the system. The lists are changed under
+ * lowmem_adj_lock and walked under rcu_read_lock(), like the task list.
+ *
+ * A walker can race with a process moving to another bucket and then
+ * finish the walk on the other list. It may miss a few processes or see
+ * some of another bucket, which does no harm: oom_score_adj is checked
+ * again for every process and the next shrinker call sees the settled
+ * lists.
+ */
+#define LOWMEM_ADJ_BUCKET_SHIFT	6
+#define LOWMEM_ADJ_BUCKETS	\
+	(((OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN) >> LOWMEM_ADJ_BUCKET_SHIFT) + 1)
+
+static struct hlist_head lowmem_adj_buckets[LOWMEM_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+
+static int lowmem_adj_bucket(int oom_score_adj)
+{
+	return (oom_score_adj - OOM_SCORE_ADJ_MIN) >> LOWMEM_ADJ_BUCKET_SHIFT;
+}
+
+/* Called for a new thread group leader, with tasklist_lock held */
+void lowmem_adj_add_task(struct task_struct *p)
+{
+	int bucket = lowmem_adj_bucket(p->signal->oom_score_adj);
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	hlist_add_head_rcu(&p->lowmem_adj_node, &lowmem_adj_buckets[bucket]);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/* Called when a thread group leader is unhashed, with tasklist_lock held */
+void lowmem_adj_del_task(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	hlist_del_init_rcu(&p->lowmem_adj_node);
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/* Called after the oom_score_adj of @p's thread group has changed */
+void lowmem_adj_update_task(struct task_struct *p)
+{
+	unsigned long flags;
+	int bucket;
+
+	rcu_read_lock();
+	p = p->group_leader;
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	/* the group may be exiting, or exec may have just replaced p */
+	if (!hlist_unhashed(&p->lowmem_adj_node)) {
+		bucket = lowmem_adj_bucket(p->signal->oom_score_adj);
+		hlist_del_rcu(&p->lowmem_adj_node);
+		hlist_add_head_rcu(&p->lowmem_adj_node,
+				   &lowmem_adj_buckets[bucket]);
+	}
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+	rcu_read_unlock();
+}
+
+/* Victim searches, protected by scan_mutex */
+static unsigned long lowmem_scan_count;
+static unsigned long lowmem_scan_tasks;
+static u64 lowmem_scan_time_ns;
+static u64 lowmem_scan_max_ns;
+
 static DEFINE_MUTEX(scan_mutex);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_PRESSURE
+/*
+ * Pressure is the share of the pages scanned by reclaim that were not
+ * reclaimed, over the last LOWMEM_PRESSURE_SAMPLES sampling intervals.
+ * Major faults count against the reclaimed pages, since most of them
+ * read back pages that were reclaimed earlier. Samples are taken from
+ * the shrinker, and from a work item while the level is not none so
+ * that the level drops again once reclaim stops.
+ */
+#define LOWMEM_PRESSURE_INTERVAL	(HZ / 10)
+#define LOWMEM_PRESSURE_SAMPLES		10
+
+enum {
+	LOWMEM_PRESSURE_NONE,
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+};
+
+static const char * const lowmem_pressure_names[] = {
+	"none",
+	"low",
+	"medium",
+	"critical",
+};
+
+struct lowmem_pressure_sample {
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long refaults;
+};
+
+static uint32_t lowmem_pressure_mode;
+static uint32_t lowmem_pressure_medium = 60;
+static uint32_t lowmem_pressure_critical = 95;
+
+/* Protected by scan_mutex */
+static struct lowmem_pressure_sample
+	lowmem_pressure_ring[LOWMEM_PRESSURE_SAMPLES + 1];
+static unsigned int lowmem_pressure_head;
+static unsigned int lowmem_pressure_count;
+static unsigned long lowmem_pressure_next;
+static unsigned long lowmem_vm_events[NR_VM_EVENT_ITEMS];
+
+static int lowmem_pressure;
+static int lowmem_pressure_level;
+static struct kobject *lowmem_kobj;
+
+static void lowmem_pressure_workfn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_pressure_work, lowmem_pressure_workfn);
+
+/* Sum a FOR_ALL_ZONES() event over all zones */
+#define lowmem_zone_events(item) \
+	lowmem_sum_events(item##_NORMAL - ZONE_NORMAL)
+
+static unsigned long lowmem_sum_events(int first)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < MAX_NR_ZONES; i++)
+		sum += lowmem_vm_events[first + i];
+	return sum;
+}
+
+static void lowmem_pressure_sample(void)
+{
+	struct lowmem_pressure_sample *new, *old;
+	unsigned long scanned, reclaimed, refaults;
+	int pressure = 0;
+	int level = LOWMEM_PRESSURE_NONE;
+
+	if (time_before(jiffies, lowmem_pressure_next))
+		return;
+	lowmem_pressure_next = jiffies + LOWMEM_PRESSURE_INTERVAL;
+
+	all_vm_events(lowmem_vm_events);
+	lowmem_pressure_head = (lowmem_pressure_head + 1) %
+		ARRAY_SIZE(lowmem_pressure_ring);
+	new = &lowmem_pressure_ring[lowmem_pressure_head];
+	new->scanned = lowmem_zone_events(PGSCAN_KSWAPD) +
+		lowmem_zone_events(PGSCAN_DIRECT);
+	new->reclaimed = lowmem_zone_events(PGSTEAL_KSWAPD) +
+		lowmem_zone_events(PGSTEAL_DIRECT);
+	new->refaults = lowmem_vm_events[PGMAJFAULT];
+	if (lowmem_pressure_count < ARRAY_SIZE(lowmem_pressure_ring))
+		lowmem_pressure_count++;
+	old = &lowmem_pressure_ring[(lowmem_pressure_head +
+				     ARRAY_SIZE(lowmem_pressure_ring) + 1 -
+				     lowmem_pressure_count) %
+				    ARRAY_SIZE(lowmem_pressure_ring)];
+
+	scanned = new->scanned - old->scanned;
+	reclaimed = new->reclaimed - old->reclaimed;
+	refaults = new->refaults - old->refaults;
+	if (scanned) {
+		reclaimed = reclaimed > refaults ? reclaimed - refaults : 0;
+		if (reclaimed > scanned)
+			reclaimed = scanned;
+		pressure = 100 - div_u64((u64)reclaimed * 100, scanned);
+		if (pressure >= lowmem_pressure_critical)
+			level = LOWMEM_PRESSURE_CRITICAL;
+		else if (pressure >= lowmem_pressure_medium)
+			level = LOWMEM_PRESSURE_MEDIUM;
+		else
+			level = LOWMEM_PRESSURE_LOW;
+	}
+
+	lowmem_pressure = pressure;
+	if (level != lowmem_pressure_level) {
+		lowmem_print(3, "lowmem_shrink: pressure %d, %s\n", pressure,
+			     lowmem_pressure_names[level]);
+		lowmem_pressure_level = level;
+		if (lowmem_kobj)
+			sysfs_notify(lowmem_kobj, NULL, "pressure_level");
+	}
+	if (level != LOWMEM_PRESSURE_NONE)
+		schedule_delayed_work(&lowmem_pressure_work,
+				      LOWMEM_PRESSURE_INTERVAL);
+}
+
+static void lowmem_pressure_workfn(struct work_struct *work)
+{
+	mutex_lock(&scan_mutex);
+	lowmem_pressure_sample();
+	mutex_unlock(&scan_mutex);
+}
+
+/*
+ * @level is the index of the minfree level that was hit, or array_size
+ * if none was.
+ */
+static int lowmem_pressure_adj(int min_score_adj, int level, int array_size)
+{
+	if (!lowmem_pressure_mode || array_size <= 0)
+		return min_score_adj;
+
+	if (level > 0 && level < array_size &&
+	    lowmem_pressure_level < LOWMEM_PRESSURE_MEDIUM)
+		min_score_adj = OOM_SCORE_ADJ_MAX + 1;
+	if (lowmem_pressure_level == LOWMEM_PRESSURE_CRITICAL &&
+	    min_score_adj > lowmem_adj[array_size - 1])
+		min_score_adj = lowmem_adj[array_size - 1];
+	return min_score_adj;
+}
+
+static ssize_t pressure_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lowmem_pressure);
+}
+
+static ssize_t pressure_level_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n",
+		       lowmem_pressure_names[lowmem_pressure_level]);
+}
+
+static struct kobj_attribute pressure_attr = __ATTR_RO(pressure);
+static struct kobj_attribute pressure_level_attr = __ATTR_RO(pressure_level);
+
+static struct attribute *lowmem_attrs[] = {
+	&pressure_attr.attr,
+	&pressure_level_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lowmem_attr_group = {
+	.attrs = lowmem_attrs,
+};
+
+static void lowmem_pressure_init(void)
+{
+	lowmem_kobj = kobject_create_and_add("lowmemorykiller", mm_kobj);
+	if (!lowmem_kobj)
+		return;
+	if (sysfs_create_group(lowmem_kobj, &lowmem_attr_group)) {
+		kobject_put(lowmem_kobj);
+		lowmem_kobj = NULL;
+	}
+}
+
+static void lowmem_pressure_exit(void)
+{
+	cancel_delayed_work_sync(&lowmem_pressure_work);
+	if (lowmem_kobj)
+		kobject_put(lowmem_kobj);
+}
+#else
+static inline void lowmem_pressure_sample(void)
+{
+}
+
+static inline int lowmem_pressure_adj(int min_score_adj, int level,
+				      int array_size)
+{
+	return min_score_adj;
+}
+
+static inline void lowmem_pressure_init(void)
+{
+}
+
+static inline void lowmem_pressure_exit(void)
+{
+}
+#endif
+
+static void lowmem_scan_done(ktime_t start, unsigned long scanned)
+{
+	u64 delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	lowmem_scan_count++;
+	lowmem_scan_tasks += scanned;
+	lowmem_scan_time_ns += delta;
+	if (delta > lowmem_scan_max_ns)
+		lowmem_scan_max_ns = delta;
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
+	struct hlist_node *pos;
 	int rem = 0;
 	int tasksize;
 	int i;
@@ -160,6 +470,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int fork_boost = 0;
 	size_t *min_array;
 	struct zone *zone;
+	int bucket, last_bucket;
+	unsigned long scanned = 0;
+	ktime_t start;
 
 	if (nr_to_scan > 0) {
 		if (!mutex_trylock(&scan_mutex)) {
@@ -168,6 +481,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			}
 			return 0;
 		}
+		lowmem_pressure_sample();
 	}
 
 	for_each_zone(zone)
@@ -205,6 +519,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	min_score_adj = lowmem_pressure_adj(min_score_adj, i, array_size);
 
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d, rfree %d\n",
@@ -225,55 +540,65 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
+	/*
+	 * The last victim may sit in any bucket, including ones below
+	 * min_score_adj that the walk below never reaches, so wait for it
+	 * here rather than while scanning.
+	 */
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		lowmem_print(2, "skipping , waiting for the last victim to die\n");
+		if (!(lowmem_only_kswapd_sleep && !current_is_kswapd())) {
+			msleep_interruptible(lowmem_sleep_ms);
+		}
+		mutex_unlock(&scan_mutex);
+		return 0;
+	}
+
+	start = ktime_get();
 	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
+	last_bucket = lowmem_adj_bucket(max(min_score_adj, OOM_SCORE_ADJ_MIN));
+	for (bucket = LOWMEM_ADJ_BUCKETS - 1;
+	     bucket >= last_bucket && !selected;
+	     bucket--) {
+		hlist_for_each_entry_rcu(tsk, pos, &lowmem_adj_buckets[bucket],
+					 lowmem_adj_node) {
+			struct task_struct *p;
+			int oom_score_adj;
+
+			scanned++;
+			if (tsk->flags & PF_KTHREAD)
+				continue;
 
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+			p = find_lock_task_mm(tsk);
+			if (!p)
+				continue;
 
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				lowmem_print(2, "skipping , waiting for process %d (%s) dead\n",
-				tsk->pid, tsk->comm);
-				rcu_read_unlock();
-				
-				if (!(lowmem_only_kswapd_sleep && !current_is_kswapd())) {
-					msleep_interruptible(lowmem_sleep_ms);
-				}
-				mutex_unlock(&scan_mutex);
-				return 0;
+			oom_score_adj = p->signal->oom_score_adj;
+			if (oom_score_adj < min_score_adj) {
+				task_unlock(p);
+				continue;
 			}
-		}
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
+			tasksize = get_mm_rss(p->mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
+			if (tasksize <= 0)
 				continue;
+			if (selected) {
+				if (oom_score_adj < selected_oom_score_adj)
+					continue;
+				if (oom_score_adj == selected_oom_score_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_score_adj = oom_score_adj;
+			selected_oom_adj = p->signal->oom_adj;
+			lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
+				     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
 	}
+	lowmem_scan_done(start, scanned);
 	if (selected) {
 		lowmem_print(1, "[%s] send sigkill to %d (%s), oom_adj %d, score_adj %d,"
 			" min_score_adj %d, size %dK, free %dK, file %dK, fork_boost %dK,"
@@ -288,6 +613,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			show_meminfo();
 			dump_tasks();
 		}
+		lowmem_deathpending = selected;
 		send_sig(SIGKILL, selected, 0);
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
 		rem -= selected_tasksize;
@@ -313,8 +639,10 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	task_free_register(&task_free_nb);
 	task_fork_register(&task_fork_nb);
 	register_shrinker(&lowmem_shrinker);
+	lowmem_pressure_init();
 	return 0;
 }
 
@@ -322,6 +650,8 @@ static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
 	task_fork_unregister(&task_fork_nb);
+	task_free_unregister(&task_free_nb);
+	lowmem_pressure_exit();
 }
 
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
@@ -416,6 +746,34 @@ module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(fork_boost, lowmem_fork_boost, uint, S_IRUGO | S_IWUSR);
+
+static int lowmem_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	u64 avg = lowmem_scan_time_ns;
+
+	if (lowmem_scan_count)
+		do_div(avg, lowmem_scan_count);
+	else
+		avg = 0;
+	return sprintf(buffer, "scans %lu tasks %lu time_ns %llu "
+		       "avg_ns %llu max_ns %llu",
+		       lowmem_scan_count, lowmem_scan_tasks,
+		       lowmem_scan_time_ns, avg, lowmem_scan_max_ns);
+}
+
+static struct kernel_param_ops lowmem_stats_ops = {
+	.get = lowmem_stats_get,
+};
+
+module_param_cb(stats, &lowmem_stats_ops, NULL, S_IRUGO);
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_PRESSURE
+module_param_named(pressure_mode, lowmem_pressure_mode, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, uint,
+		   S_IRUGO | S_IWUSR);
+#endif
 module_param_array_named(fork_boost_minfree, lowmem_fork_boost_minfree, uint,
 			 &lowmem_fork_boost_minfree_size, S_IRUGO | S_IWUSR);
 
@@ -0,0 +1,264 @@
+/*
+ * Compression streams for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zcomp.h"
+
+static struct zcomp_backend *backends[ZCOMP_NR_BACKENDS] = {
+	[ZCOMP_LZO]	= &zcomp_lzo,
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+	[ZCOMP_LZ4]	= &zcomp_lz4,
+	[ZCOMP_LZ4HC]	= &zcomp_lz4hc,
+#endif
+};
+
+/* Returns NULL for algorithms not built into this kernel */
+struct zcomp_backend *zcomp_backend(int id)
+{
+	if (id < 0 || id >= ZCOMP_NR_BACKENDS)
+		return NULL;
+	return backends[id];
+}
+
+int zcomp_backend_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ZCOMP_NR_BACKENDS; i++) {
+		if (backends[i] && sysfs_streq(name, backends[i]->name))
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (is_vmalloc_addr(zstrm->workmem))
+		vfree(zstrm->workmem);
+	else
+		kfree(zstrm->workmem);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * Called from the I/O path once the pool is up, hence GFP_NOIO.
+ */
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+	size_t size = comp->backend->workmem_size;
+
+	zstrm = kmalloc(sizeof(*zstrm), GFP_NOIO);
+	if (!zstrm)
+		return NULL;
+
+	/* LZ4HC wants 256K of workmem; don't insist on contiguous pages */
+	zstrm->workmem = kmalloc(size, GFP_NOIO | __GFP_NOWARN |
+				 __GFP_NORETRY);
+	if (!zstrm->workmem)
+		zstrm->workmem = __vmalloc(size, GFP_NOIO | __GFP_HIGHMEM,
+					   PAGE_KERNEL);
+	/*
+	 * The buffer is 2 pages since a compressed page may be slightly
+	 * larger than the input.
+	 */
+	zstrm->buffer = (void *)__get_free_pages(GFP_NOIO | __GFP_ZERO, 1);
+	if (!zstrm->workmem || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/*
+ * Get an idle stream, allocating a new one if we are below
+ * comp->max_strm. Otherwise sleep until a stream is released.
+ * May sleep, so must not be called from atomic context.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+	ktime_t wait_start = ktime_set(0, 0);
+	bool waited = false;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			break;
+		}
+
+		if (comp->avail_strm < comp->max_strm) {
+			comp->avail_strm++;
+			spin_unlock(&comp->strm_lock);
+
+			zstrm = zcomp_strm_alloc(comp);
+			if (zstrm) {
+				spin_lock(&comp->strm_lock);
+				break;
+			}
+
+			spin_lock(&comp->strm_lock);
+			comp->avail_strm--;
+			/*
+			 * Allocation failed under memory pressure: fall back
+			 * to waiting for one of the existing streams.
+			 */
+		}
+		spin_unlock(&comp->strm_lock);
+
+		if (!waited) {
+			wait_start = ktime_get();
+			waited = true;
+		}
+		wait_event(comp->strm_wait,
+			!list_empty(&comp->idle_strm) ||
+			comp->avail_strm < comp->max_strm);
+	}
+
+	if (waited) {
+		comp->strm_waits++;
+		comp->strm_wait_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), wait_start));
+	}
+	spin_unlock(&comp->strm_lock);
+
+	return zstrm;
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm > comp->max_strm) {
+		/* max_comp_streams was lowered while this one was busy */
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		zcomp_strm_free(zstrm);
+		return;
+	}
+	list_add(&zstrm->list, &comp->idle_strm);
+	spin_unlock(&comp->strm_lock);
+
+	wake_up(&comp->strm_wait);
+}
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len)
+{
+	return comp->backend->compress(src, zstrm->buffer, dst_len,
+				       zstrm->workmem);
+}
+
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst)
+{
+	return comp->backend->decompress(src, src_len, dst);
+}
+
+/*
+ * Change the stream limit. Surplus idle streams are freed right
+ * away, busy ones when their writer releases them.
+ */
+void zcomp_set_max_streams(struct zcomp *comp, int num_strm)
+{
+	struct zcomp_strm *zstrm;
+	LIST_HEAD(victims);
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = num_strm;
+	while (comp->avail_strm > num_strm &&
+			!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_move(&zstrm->list, &victims);
+		comp->avail_strm--;
+	}
+	spin_unlock(&comp->strm_lock);
+
+	while (!list_empty(&victims)) {
+		zstrm = list_entry(victims.next, struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+
+	/* Writers may now be allowed to allocate a new stream */
+	wake_up_all(&comp->strm_wait);
+}
+
+void zcomp_wait_stats(struct zcomp *comp, u64 *waits, u64 *wait_ns)
+{
+	spin_lock(&comp->strm_lock);
+	*waits = comp->strm_waits;
+	*wait_ns = comp->strm_wait_ns;
+	spin_unlock(&comp->strm_lock);
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	/* No writers can be active: called with zram->init_lock held */
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	kfree(comp);
+}
+
+/*
+ * One stream is allocated up front so that a writer can always make
+ * progress, even if later stream allocations fail.
+ */
+struct zcomp *zcomp_create(int id, int max_strm)
+{
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+	struct zcomp_backend *backend = zcomp_backend(id);
+
+	if (!backend)
+		return NULL;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	comp->backend = backend;
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->max_strm = max_strm;
+
+	zstrm = zcomp_strm_alloc(comp);
+	if (!zstrm) {
+		kfree(comp);
+		return NULL;
+	}
+	list_add(&zstrm->list, &comp->idle_strm);
+	comp->avail_strm = 1;
+
+	return comp;
+}
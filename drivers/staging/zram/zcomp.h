@@ -0,0 +1,95 @@
+/*
+ * Compression streams for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+/* Compression algorithms a zram device can be configured with */
+enum zcomp_backend_id {
+	ZCOMP_LZO,
+	ZCOMP_LZ4,
+	ZCOMP_LZ4HC,
+	ZCOMP_NR_BACKENDS,
+};
+
+/*
+ * Operations of one compression algorithm. Both callbacks work on
+ * a single page and return 0 on success.
+ */
+struct zcomp_backend {
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+	/* size of the per-stream workmem passed to compress() */
+	size_t workmem_size;
+	const char *name;
+};
+
+extern struct zcomp_backend zcomp_lzo;
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+extern struct zcomp_backend zcomp_lz4;
+extern struct zcomp_backend zcomp_lz4hc;
+#endif
+
+/*
+ * A compression stream: everything a single writer needs to
+ * compress one page without touching shared state.
+ */
+struct zcomp_strm {
+	/* compression buffer, 2 pages to cope with worst-case expansion */
+	void *buffer;
+	/* compressor private working memory */
+	void *workmem;
+	struct list_head list;
+};
+
+/*
+ * Pool of compression streams. Writers grab an idle stream, allocate
+ * a new one while fewer than max_strm exist, or sleep on strm_wait
+ * until another writer releases one.
+ */
+struct zcomp {
+	struct zcomp_backend *backend;
+
+	spinlock_t strm_lock;	/* protects everything below */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* no. of allocated streams */
+	int max_strm;		/* upper limit on avail_strm */
+
+	/* stream contention stats */
+	u64 strm_waits;		/* no. of writers that had to sleep */
+	u64 strm_wait_ns;	/* total time writers spent sleeping */
+};
+
+struct zcomp_backend *zcomp_backend(int id);
+int zcomp_backend_find(const char *name);
+
+struct zcomp *zcomp_create(int id, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+void zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+void zcomp_wait_stats(struct zcomp *comp, u64 *waits, u64 *wait_ns);
+
+#endif
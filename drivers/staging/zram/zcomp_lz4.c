@@ -0,0 +1,49 @@
+/*
+ * LZ4 and LZ4HC backends for zram compression streams
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/lz4.h>
+
+#include "zcomp.h"
+
+static int zcomp_lz4_compress(const unsigned char *src, unsigned char *dst,
+		size_t *dst_len, void *workmem)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zcomp_lz4hc_compress(const unsigned char *src, unsigned char *dst,
+		size_t *dst_len, void *workmem)
+{
+	return lz4hc_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+/* LZ4 and LZ4HC share the same stream format and decompressor */
+static int zcomp_lz4_decompress(const unsigned char *src, size_t src_len,
+		unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+
+	return lz4_decompress_unknownoutputsize(src, src_len, dst, &dst_len);
+}
+
+struct zcomp_backend zcomp_lz4 = {
+	.compress = zcomp_lz4_compress,
+	.decompress = zcomp_lz4_decompress,
+	.workmem_size = LZ4_MEM_COMPRESS,
+	.name = "lz4",
+};
+
+struct zcomp_backend zcomp_lz4hc = {
+	.compress = zcomp_lz4hc_compress,
+	.decompress = zcomp_lz4_decompress,
+	.workmem_size = LZ4HC_MEM_COMPRESS,
+	.name = "lz4hc",
+};
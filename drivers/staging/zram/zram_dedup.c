@@ -0,0 +1,183 @@
+/*
+ * Same-page deduplication for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/*
+ * One hash bucket per 2^ZRAM_HASH_SHIFT disk pages keeps the
+ * per-bucket trees short without costing much memory.
+ */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 4)
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+/*
+ * Checksums may collide, so confirm a candidate by comparing its
+ * decompressed content with @mem. @buf is a PAGE_SIZE scratch buffer.
+ */
+static int zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+				unsigned char *mem, unsigned char *buf)
+{
+	int match;
+	unsigned char *cmem;
+
+	if (entry->len == PAGE_SIZE) {
+		cmem = kmap_atomic(entry->handle);
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem);
+		return match;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
+	match = !zcomp_decompress(zram->comp,
+				cmem + sizeof(struct zobj_header),
+				entry->len, buf);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match && !memcmp(mem, buf, PAGE_SIZE);
+}
+
+/*
+ * Look for a stored object with the same content as @mem. On success
+ * a reference is taken on the returned entry.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, unsigned char *mem,
+				u32 checksum, unsigned char *buf)
+{
+	struct rb_node *rb_node, *first = NULL;
+	struct zram_entry *entry;
+	struct zram_hash *hash = zram_dedup_bucket(zram, checksum);
+
+	spin_lock(&hash->lock);
+
+	/* Find the leftmost entry with this checksum */
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == entry->checksum) {
+			first = rb_node;
+			rb_node = rb_node->rb_left;
+		} else if (checksum < entry->checksum) {
+			rb_node = rb_node->rb_left;
+		} else {
+			rb_node = rb_node->rb_right;
+		}
+	}
+
+	for (rb_node = first; rb_node; rb_node = rb_next(rb_node)) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+		if (zram_dedup_match(zram, entry, mem, buf)) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			return entry;
+		}
+	}
+
+	spin_unlock(&hash->lock);
+	return NULL;
+}
+
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry)
+{
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *cur;
+	struct zram_hash *hash = zram_dedup_bucket(zram, entry->checksum);
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		cur = rb_entry(parent, struct zram_entry, rb_node);
+		if (entry->checksum < cur->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Drop a reference and return how many are left. The last reference
+ * also unhashes the entry; freeing the object is up to the caller.
+ */
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	unsigned long refcount;
+	struct zram_hash *hash;
+
+	/* Entries are only shared (and hashed) with dedup enabled */
+	if (!zram->hash)
+		return --entry->refcount;
+
+	hash = zram_dedup_bucket(zram, entry->checksum);
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount && !RB_EMPTY_NODE(&entry->rb_node)) {
+		rb_erase(&entry->rb_node, &hash->rb_root);
+		RB_CLEAR_NODE(&entry->rb_node);
+	}
+	spin_unlock(&hash->lock);
+
+	return refcount;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	zram->hash_size = num_pages >> ZRAM_HASH_SHIFT;
+	zram->hash_size = clamp_t(size_t, zram->hash_size,
+				ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX);
+	zram->hash_size = rounddown_pow_of_two(zram->hash_size);
+
+	zram->hash = vzalloc(zram->hash_size * sizeof(struct zram_hash));
+	if (!zram->hash) {
+		pr_err("Error allocating zram dedup hash\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
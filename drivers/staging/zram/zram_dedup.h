@@ -0,0 +1,47 @@
+/*
+ * Same-page deduplication for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct zram;
+
+/*
+ * One stored object (compressed zsmalloc object or uncompressed page),
+ * shared by every table entry whose page has the same content.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->hash[checksum] */
+	void *handle;
+	u16 len;		/* object size; PAGE_SIZE if uncompressed */
+	u32 checksum;
+	unsigned long refcount;	/* no. of table entries pointing here */
+};
+
+/* Hash bucket: entries ordered by checksum */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+u32 zram_dedup_checksum(unsigned char *mem);
+struct zram_entry *zram_dedup_find(struct zram *zram, unsigned char *mem,
+				u32 checksum, unsigned char *buf);
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry);
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+
+#endif
@@ -25,11 +25,14 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/cpumask.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -38,6 +41,7 @@
 /* Globals */
 static int zram_major;
 struct zram *zram_devices;
+struct kmem_cache *zram_entry_cache;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
@@ -71,6 +75,27 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+static void zram_comp_stat_update(struct zram *zram, size_t orig,
+			size_t compr, ktime_t start)
+{
+	struct zram_comp_stats *cs = &zram->comp_stats[zram->comp_backend];
+
+	atomic64_add(orig, &cs->orig_bytes);
+	atomic64_add(compr, &cs->compr_bytes);
+	atomic64_inc(&cs->num_compress);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		     &cs->compress_ns);
+}
+
+static void zram_decomp_stat_update(struct zram *zram, ktime_t start)
+{
+	struct zram_comp_stats *cs = &zram->comp_stats[zram->comp_backend];
+
+	atomic64_inc(&cs->num_decompress);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		     &cs->decompress_ns);
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -133,11 +158,177 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static u32 zram_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return ts.tv_sec;
+}
+
+/* Racy under the read lock, but an access time need not be exact */
+static void zram_touch(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = zram_now();
+}
+
+static bool zram_has_bdev(struct zram *zram)
+{
+	return zram->bdev != NULL;
+}
+
+/* Returns a free block on the backing device, or 0 if it is full */
+static unsigned long zram_bd_alloc(struct zram *zram)
+{
+	unsigned long blk;
+
+	do {
+		blk = find_first_zero_bit(zram->bitmap, zram->nr_pages);
+		if (blk >= zram->nr_pages)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bitmap));
+
+	return blk;
+}
+
+static void zram_bd_free(struct zram *zram, unsigned long blk)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk, zram->bitmap));
+}
+
+struct zram_bd_io {
+	struct completion done;
+	int error;
+};
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_io *io = bio->bi_private;
+
+	io->error = err;
+	complete(&io->done);
+}
+
+/* Synchronously read or write one page of the backing device */
+static int zram_bd_rw(struct zram *zram, struct page *page,
+			unsigned long blk, int rw)
+{
+	struct bio *bio;
+	struct zram_bd_io io;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	init_completion(&io.done);
+	io.error = 0;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = &io;
+
+	submit_bio(rw == READ ? READ_SYNC : WRITE_SYNC, bio);
+	wait_for_completion(&io.done);
+	bio_put(bio);
+
+	if (rw == READ)
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+	else
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+
+	return io.error;
+}
+
+struct zram_bd_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int error;
+};
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct zram_bd_work *w = container_of(work, struct zram_bd_work, work);
+
+	w->error = zram_bd_rw(w->zram, w->page, w->blk, READ);
+}
+
+/*
+ * Read block @blk of the backing device into @mem. This is called
+ * from zram_make_request(), where a bio submitted to another device
+ * is only queued until we return, so the I/O is done by a worker.
+ */
+static int zram_bd_read(struct zram *zram, char *mem, unsigned long blk)
+{
+	void *src;
+	struct zram_bd_work w;
+
+	w.page = alloc_page(GFP_NOIO);
+	if (!w.page)
+		return -ENOMEM;
+	w.zram = zram;
+	w.blk = blk;
+
+	INIT_WORK_ONSTACK(&w.work, zram_bd_read_work);
+	queue_work(system_unbound_wq, &w.work);
+	flush_work(&w.work);
+	destroy_work_on_stack(&w.work);
+
+	if (!w.error) {
+		src = kmap_atomic(w.page);
+		memcpy(mem, src, PAGE_SIZE);
+		kunmap_atomic(src);
+	}
+	__free_page(w.page);
+
+	return w.error;
+}
+#else
+static inline void zram_touch(struct zram *zram, u32 index) {}
+static inline bool zram_has_bdev(struct zram *zram) { return false; }
+#endif
+
+/* Free the object of an entry nobody references any more */
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry)
+{
+	if (unlikely(entry->len == PAGE_SIZE)) {
+		__free_page(entry->handle);
+		zram_stat_dec(&zram->stats.pages_expand);
+	} else {
+		zs_free(zram->mem_pool, entry->handle);
+	}
+
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+	kmem_cache_free(zram_entry_cache, entry);
+}
+
+/* Called with zram->tb_lock held for writing */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	void *handle = zram->table[index].handle;
+	struct zram_entry *entry = zram->table[index].entry;
+	u16 size = zram->table[index].size;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Tells a writeback in flight that its copy is stale */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_bd_free(zram, zram->table[index].bdev_index);
+		zram->table[index].bdev_index = 0;
+		zram_stat_dec(&zram->stats.pages_wb);
+		return;
+	}
+#endif
 
-	if (unlikely(!handle)) {
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -149,25 +340,22 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		__free_page(handle);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
-	}
-
-	zs_free(zram->mem_pool, handle);
-
-	if (zram->table[index].size <= PAGE_SIZE / 2)
+	zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+	if (size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
-
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size,
-			zram->table[index].size);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].handle = NULL;
+	zram->table[index].entry = NULL;
 	zram->table[index].size = 0;
+
+	if (zram_dedup_put(zram, entry)) {
+		/* Object is still shared with other pages */
+		zram_stat_dec(&zram->stats.pages_dup);
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, size);
+		return;
+	}
+
+	zram_entry_free(zram, entry);
 }
 
 static void handle_zero_page(struct bio_vec *bvec)
@@ -182,170 +370,168 @@ static void handle_zero_page(struct bio_vec *bvec)
 	flush_dcache_page(page);
 }
 
-static void handle_uncompressed_page(struct zram *zram, struct bio_vec *bvec,
-				     u32 index, int offset)
+static inline int is_partial_io(struct bio_vec *bvec)
 {
-	struct page *page = bvec->bv_page;
-	unsigned char *user_mem, *cmem;
-
-	user_mem = kmap_atomic(page);
-	cmem = kmap_atomic(zram->table[index].handle);
-
-	memcpy(user_mem + bvec->bv_offset, cmem + offset, bvec->bv_len);
-	kunmap_atomic(cmem);
-	kunmap_atomic(user_mem);
-
-	flush_dcache_page(page);
+	return bvec->bv_len != PAGE_SIZE;
 }
 
-static void handle_uncompressed_page(struct zram *zram, struct bio_vec *bvec,
-				     u32 index, int offset)
+/*
+ * Decompress slot @index into @mem. A slot on the backing device has to
+ * be read with I/O that sleeps; without @may_sleep that is refused with
+ * -EAGAIN so the caller can retry outside its atomic section.
+ */
+static int __zram_decompress_page(struct zram *zram, char *mem, u32 index,
+				  bool may_sleep)
 {
-	struct page *page = bvec->bv_page;
-	unsigned char *user_mem, *cmem;
+	int ret = 0;
+	void *handle;
+	ktime_t start;
+	unsigned char *cmem;
+	struct zram_entry *entry;
+
+	read_lock(&zram->tb_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk = zram->table[index].bdev_index;
+
+		read_unlock(&zram->tb_lock);
+		if (!may_sleep)
+			return -EAGAIN;
+		ret = zram_bd_read(zram, mem, blk);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, "
+				"page=%u\n", ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+		}
+		return ret;
+	}
+#endif
+	entry = zram->table[index].entry;
+	if (!entry || zram_test_flag(zram, index, ZRAM_ZERO)) {
+		read_unlock(&zram->tb_lock);
+		memset(mem, 0, PAGE_SIZE);
+		return 0;
+	}
+	handle = entry->handle;
 
-	user_mem = kmap_atomic(page);
-	cmem = kmap_atomic(zram->table[index].handle);
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(handle);
+		memcpy(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem);
+	} else {
+		cmem = zs_map_object(zram->mem_pool, handle);
+		start = ktime_get();
+		ret = zcomp_decompress(zram->comp,
+				cmem + sizeof(struct zobj_header),
+				zram->table[index].size, mem);
+		zram_decomp_stat_update(zram, start);
+		zs_unmap_object(zram->mem_pool, handle);
+	}
+	read_unlock(&zram->tb_lock);
 
-	memcpy(user_mem + bvec->bv_offset, cmem + offset, bvec->bv_len);
-	kunmap_atomic(cmem);
-	kunmap_atomic(user_mem);
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
 
-	flush_dcache_page(page);
+	return 0;
 }
 
-static inline int is_partial_io(struct bio_vec *bvec)
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 {
-	return bvec->bv_len != PAGE_SIZE;
+	return __zram_decompress_page(zram, mem, index, true);
 }
 
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
+	int unwritten;
+	int bounce = 0;
 	struct page *page;
-	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem, *uncmem = NULL;
+	unsigned char *user_mem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
-		return 0;
+	read_lock(&zram->tb_lock);
+	unwritten = !zram->table[index].entry;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unwritten = 0;
+		bounce = 1;
 	}
-
-	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].handle)) {
+	if (!unwritten)
+		zram_touch(zram, index);
+#endif
+	if (unwritten && !zram_test_flag(zram, index, ZRAM_ZERO)) {
+		/* Requested page is not present in compressed area */
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
-		return 0;
 	}
+	read_unlock(&zram->tb_lock);
 
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		handle_uncompressed_page(zram, bvec, index, offset);
+	if (unwritten) {
+		handle_zero_page(bvec);
 		return 0;
 	}
 
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		handle_uncompressed_page(zram, bvec, index, offset);
-		return 0;
+	/*
+	 * Partial I/O needs the whole page. A read from the backing
+	 * device sleeps, so it cannot target a kmap_atomic() mapping.
+	 */
+	if (is_partial_io(bvec))
+		bounce = 1;
+
+	if (!bounce) {
+		user_mem = kmap_atomic(page);
+		ret = __zram_decompress_page(zram, user_mem, index, false);
+		kunmap_atomic(user_mem);
+		/* Written back since we looked at the slot */
+		if (ret == -EAGAIN)
+			bounce = 1;
 	}
 
-	if (is_partial_io(bvec)) {
+	if (bounce) {
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			return -ENOMEM;
 		}
-	}
-
-	user_mem = kmap_atomic(page);
-	if (!is_partial_io(bvec))
-		uncmem = user_mem;
-	clen = PAGE_SIZE;
-
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
-
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
-
-	if (is_partial_io(bvec)) {
+		ret = zram_decompress_page(zram, uncmem, index);
+		user_mem = kmap_atomic(page);
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
 		       bvec->bv_len);
+		kunmap_atomic(user_mem);
 		kfree(uncmem);
 	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
-	kunmap_atomic(user_mem);
-
-	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
+	if (unlikely(ret))
 		return ret;
-	}
 
 	flush_dcache_page(page);
 
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
-{
-	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
-	unsigned char *cmem;
-
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].handle) {
-		memset(mem, 0, PAGE_SIZE);
-		return 0;
-	}
-
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
-
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		memcpy(mem, cmem, PAGE_SIZE);
-		kunmap_atomic(cmem);
-		return 0;
-	}
-
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
-
-	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
-	}
-
-	return 0;
-}
-
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
+	int dup = 0;
+	u32 checksum = 0;
 	size_t clen;
 	void *handle;
-	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	ktime_t start;
+	struct zcomp_strm *zstrm;
+	struct zram_entry *entry;
+	struct page *page, *page_store = NULL;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -358,20 +544,13 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
-		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		ret = zram_decompress_page(zram, uncmem, index);
+		if (ret)
 			goto out;
-		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	/* May sleep waiting for an idle stream, so do this before kmap */
+	zstrm = zcomp_strm_find(zram->comp);
 
 	user_mem = kmap_atomic(page);
 
@@ -383,25 +562,50 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
+		zcomp_strm_release(zram->comp, zstrm);
+
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
+		write_unlock(&zram->tb_lock);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	/*
+	 * Same content already stored? Then share its object and skip
+	 * compression altogether. The stream buffer is free until we
+	 * compress, so use it as scratch space for the comparison.
+	 */
+	if (zram->hash) {
+		checksum = zram_dedup_checksum(uncmem);
+		entry = zram_dedup_find(zram, uncmem, checksum,
+					zstrm->buffer);
+		if (entry) {
+			kunmap_atomic(user_mem);
+			zcomp_strm_release(zram->comp, zstrm);
+			clen = entry->len;
+			dup = 1;
+			goto update_table;
+		}
+	}
+
+	start = ktime_get();
+	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 
 	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
+		zcomp_strm_release(zram->comp, zstrm);
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
+	zram_comp_stat_update(zram, PAGE_SIZE, clen, start);
 
 	/*
 	 * Page is incompressible. Store it as-is (uncompressed)
@@ -409,6 +613,8 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	 * errors which has side effect of hanging the system.
 	 */
 	if (unlikely(clen > max_zpage_size)) {
+		zcomp_strm_release(zram->comp, zstrm);
+
 		clen = PAGE_SIZE;
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
@@ -418,17 +624,19 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
 		handle = page_store;
-		src = kmap_atomic(page);
+		src = is_partial_io(bvec) ? uncmem : kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
-		goto memstore;
+		memcpy(cmem, src, PAGE_SIZE);
+		kunmap_atomic(cmem);
+		if (!is_partial_io(bvec))
+			kunmap_atomic(src);
+		goto new_entry;
 	}
 
-	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
+	handle = zs_malloc(zram->mem_pool, clen + sizeof(struct zobj_header));
 	if (!handle) {
+		zcomp_strm_release(zram->comp, zstrm);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		ret = -ENOMEM;
@@ -436,37 +644,66 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	}
 	cmem = zs_map_object(zram->mem_pool, handle);
 
-memstore:
 #if 0
 	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
+	zheader = (struct zobj_header *)cmem;
+	zheader->table_idx = index;
+	cmem += sizeof(*zheader);
 #endif
 
-	memcpy(cmem, src, clen);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, handle);
+	zcomp_strm_release(zram->comp, zstrm);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		kunmap_atomic(cmem);
-		kunmap_atomic(src);
-	} else {
-		zs_unmap_object(zram->mem_pool, handle);
+new_entry:
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (unlikely(!entry)) {
+		if (page_store)
+			__free_page(page_store);
+		else
+			zs_free(zram->mem_pool, handle);
+		ret = -ENOMEM;
+		goto out;
 	}
+	entry->handle = handle;
+	entry->len = clen;
+	entry->checksum = checksum;
+	entry->refcount = 1;
+	RB_CLEAR_NODE(&entry->rb_node);
+	if (zram->hash)
+		zram_dedup_insert(zram, entry);
+
+update_table:
+	/*
+	 * Only the table update is serialised: free the old object
+	 * (if any) and publish the new one.
+	 */
+	write_lock(&zram->tb_lock);
+	zram_free_page(zram, index);
 
-	zram->table[index].handle = handle;
+	zram->table[index].entry = entry;
 	zram->table[index].size = clen;
+	zram_touch(zram, index);
+	if (clen == PAGE_SIZE)
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (dup) {
+		zram_stat_inc(&zram->stats.pages_dup);
+		zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
+	} else {
+		if (page_store)
+			zram_stat_inc(&zram->stats.pages_expand);
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	}
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
-
-	return 0;
+	write_unlock(&zram->tb_lock);
 
 out:
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -477,15 +714,10 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 {
 	int ret;
 
-	if (rw == READ) {
-		down_read(&zram->lock);
+	if (rw == READ)
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
+	else
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
 
 	return ret;
 }
@@ -606,35 +838,235 @@ error:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static bool zram_wb_candidate(struct zram *zram, size_t index,
+			enum zram_wb_mode mode, u32 now)
+{
+	if (!zram->table[index].entry ||
+	    zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return false;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return now - zram->table[index].ac_time >= zram->wb_idle_secs;
+}
+
+/*
+ * Move the pages selected by @mode to the backing device. Must be
+ * called with zram->init_lock held for reading on an initialized
+ * device. The slot is marked ZRAM_UNDER_WB while its data is being
+ * written; if it is overwritten or freed in the meantime the flag is
+ * cleared and the block we wrote is simply dropped.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int ret = 0;
+	u32 now = zram_now();
+	size_t index, num_pages;
+	unsigned long blk;
+	struct page *page;
+
+	if (!zram_has_bdev(zram))
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->wb_lock);
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < num_pages; index++) {
+		write_lock(&zram->tb_lock);
+		if (!zram_wb_candidate(zram, index, mode, now)) {
+			write_unlock(&zram->tb_lock);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+
+		blk = zram_bd_alloc(zram);
+		if (!blk) {
+			ret = -ENOSPC;
+			goto abort;
+		}
+
+		ret = zram_decompress_page(zram, page_address(page), index);
+		if (!ret)
+			ret = zram_bd_rw(zram, page, blk, WRITE);
+		if (ret) {
+			zram_bd_free(zram, blk);
+			goto abort;
+		}
+
+		write_lock(&zram->tb_lock);
+		if (zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_free_page(zram, index);
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram->table[index].bdev_index = blk;
+			zram_stat_inc(&zram->stats.pages_wb);
+			blk = 0;
+		}
+		write_unlock(&zram->tb_lock);
+
+		/* Slot was rewritten or discarded while we were at it */
+		if (blk)
+			zram_bd_free(zram, blk);
+
+		cond_resched();
+	}
+	goto out;
+
+abort:
+	write_lock(&zram->tb_lock);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	write_unlock(&zram->tb_lock);
+out:
+	mutex_unlock(&zram->wb_lock);
+	__free_page(page);
+	return ret;
+}
+
+/*
+ * Periodic writeback: incompressible pages go out on every pass, the
+ * rest once they have been idle for wb_idle_secs. A reset holds
+ * init_lock while it cancels us, hence the trylock.
+ */
+static void zram_wb_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work),
+					struct zram, wb_work);
+
+	if (down_read_trylock(&zram->init_lock)) {
+		if (zram->init_done &&
+		    !zram_writeback(zram, ZRAM_WB_HUGE))
+			zram_writeback(zram, ZRAM_WB_IDLE);
+		up_read(&zram->init_lock);
+	}
+
+	zram_wb_schedule(zram);
+}
+
+void zram_wb_schedule(struct zram *zram)
+{
+	if (zram->wb_idle_secs && zram_has_bdev(zram))
+		queue_delayed_work(system_long_wq, &zram->wb_work,
+				zram->wb_idle_secs * HZ);
+}
+
+static void zram_release_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	set_blocksize(zram->bdev, zram->old_block_size);
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
+
+/*
+ * Attach the block device at @path, or detach the current one if
+ * @path is "none". Called with init_lock held for writing on an
+ * uninitialized device.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	struct file *file;
+	struct inode *inode;
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap = NULL;
+
+	zram_release_backing_dev(zram);
+	if (sysfs_streq(path, "none"))
+		return 0;
+
+	file = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	inode = file->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	ret = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (ret < 0)
+		goto out_close;
+
+	/* Block 0 is reserved so that bdev_index 0 never names a block */
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+	set_bit(0, bitmap);
+
+	zram->old_block_size = block_size(bdev);
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto out_free;
+
+	zram->backing_dev = file;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	pr_info("%s: backing device %s, %lu pages\n",
+		zram->disk->disk_name, path, nr_pages);
+	return 0;
+
+out_free:
+	vfree(bitmap);
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_close:
+	filp_close(file, NULL);
+	return ret;
+}
+#endif
+
 void __zram_reset_device(struct zram *zram)
 {
 	size_t index;
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	cancel_delayed_work_sync(&zram->wb_work);
+#endif
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		void *handle = zram->table[index].handle;
-		if (!handle)
-			continue;
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(handle);
-		else
-			zs_free(zram->mem_pool, handle);
-	}
+	zram_dedup_fini(zram);
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	zs_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -664,17 +1096,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->comp_backend, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error allocating compression streams\n");
 		ret = -ENOMEM;
 		goto fail_no_table;
 	}
@@ -692,14 +1116,24 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	if (zram->use_dedup) {
+		ret = zram_dedup_init(zram, num_pages);
+		if (ret)
+			goto fail;
+	}
+
 	zram->init_done = 1;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_wb_schedule(zram);
+#endif
 	up_write(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
@@ -721,7 +1155,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -734,9 +1170,17 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = -ENOMEM;
 
-	init_rwsem(&zram->lock);
+	rwlock_init(&zram->tb_lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	INIT_DELAYED_WORK(&zram->wb_work, zram_wb_work);
+	mutex_init(&zram->wb_lock);
+#endif
+
+	/* One compression stream per CPU unless told otherwise */
+	zram->max_comp_streams = num_online_cpus();
+	zram->comp_backend = ZCOMP_LZO;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -827,11 +1271,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -861,6 +1311,8 @@ free_devices:
 	kfree(zram_devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -877,12 +1329,16 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+		zram_release_backing_dev(zram);
+#endif
 		put_disk(zram->disk);
 	}
 
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(zram_devices);
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
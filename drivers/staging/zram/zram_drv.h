@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -38,18 +42,6 @@ struct zobj_header {
 #endif
 };
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -63,8 +55,8 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -86,6 +78,12 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page lives on the backing device (table[].bdev_index) */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -93,10 +91,16 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	void *handle;
+	union {
+		struct zram_entry *entry;	/* NULL for zero/unwritten pages */
+		unsigned long bdev_index;	/* block on backing dev (ZRAM_WB) */
+	};
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds of monotonic time */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -111,16 +115,40 @@ struct zram_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_dup;		/* no. of pages sharing an existing object */
+	u64 dup_data_size;	/* compressed bytes saved by deduplication */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of pages read from the backing device */
+	u64 bd_writes;		/* no. of pages written to the backing device */
+};
+
+/* Which pages zram_writeback() moves to the backing device */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,		/* pages stored uncompressed */
+	ZRAM_WB_IDLE,		/* pages not accessed for wb_idle_secs */
+};
+
+/*
+ * Per-algorithm counters. These survive device reset so that
+ * algorithms can be compared on the same workload.
+ */
+struct zram_comp_stats {
+	atomic64_t orig_bytes;		/* input to compress() */
+	atomic64_t compr_bytes;		/* output of compress() */
+	atomic64_t num_compress;
+	atomic64_t compress_ns;
+	atomic64_t num_decompress;
+	atomic64_t decompress_ns;
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	rwlock_t tb_lock;	/* protect table entries and 32-bit stats;
+				 * compression itself runs unlocked on a
+				 * per-writer zcomp stream */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -131,8 +159,32 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Upper limit on the no. of concurrent compression streams */
+	int max_comp_streams;
+	/* Compression algorithm (enum zcomp_backend_id) */
+	int comp_backend;
+	/* Same-page deduplication; hash is NULL when disabled */
+	int use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device for idle and incompressible pages, or NULL */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned int old_block_size;
+	unsigned long *bitmap;	/* allocated blocks; block 0 is never used */
+	unsigned long nr_pages;	/* size of the backing device in pages */
+	unsigned int wb_idle_secs;	/* 0 disables periodic writeback */
+	struct delayed_work wb_work;
+	/*
+	 * One writeback pass at a time, otherwise a second pass could
+	 * claim a slot whose ZRAM_UNDER_WB was cleared and set again.
+	 */
+	struct mutex wb_lock;
+#endif
 
 	struct zram_stats stats;
+	struct zram_comp_stats comp_stats[ZCOMP_NR_BACKENDS];
 };
 
 extern struct zram *zram_devices;
@@ -141,7 +193,14 @@ unsigned int zram_get_num_devices(void);
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+extern struct kmem_cache *zram_entry_cache;
+
 extern int zram_init_device(struct zram *zram);
 extern void __zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+extern void zram_wb_schedule(struct zram *zram);
+#endif
 
 #endif
@@ -27,6 +27,10 @@
 #include <linux/cpumask.h>
 #include <linux/cpu.h>
 #include <linux/vmalloc.h>
+#include <linux/bit_spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
 
 #include "zsmalloc.h"
 #include "zsmalloc_int.h"
@@ -122,6 +126,7 @@ static void insert_zspage(struct page *page, struct size_class *class,
 		list_add_tail(&page->lru, &(*head)->lru);
 
 	*head = page;
+	class->nr_zspages[fullness]++;
 }
 
 static void remove_zspage(struct page *page, struct size_class *class,
@@ -143,6 +148,7 @@ static void remove_zspage(struct page *page, struct size_class *class,
 					struct page, lru);
 
 	list_del_init(&page->lru);
+	class->nr_zspages[fullness]--;
 }
 
 static enum fullness_group fix_fullness_group(struct zs_pool *pool,
@@ -230,30 +236,69 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single obj value */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
-		return NULL;
+		return 0;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
+	obj <<= OBJ_TAG_BITS;
 
-	return (void *)handle;
+	return obj;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(void *handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given obj value */
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	unsigned long hval = (unsigned long)handle;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
 
-	*page = pfn_to_page(hval >> OBJ_INDEX_BITS);
-	*obj_idx = hval & OBJ_INDEX_MASK;
+/* Pin bit of @handle is preserved */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *slot = (unsigned long *)handle;
+
+	*slot = obj | (*slot & (1UL << HANDLE_PIN_BIT));
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static unsigned long alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(pool->handle_cachep,
+					pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void free_handle(struct zs_pool *pool, unsigned long handle)
+{
+	kmem_cache_free(pool->handle_cachep, (void *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -330,7 +375,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -341,7 +386,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -396,9 +441,9 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
-	first_page->objects = class->zspage_order * PAGE_SIZE / class->size;
+	first_page->objects = class->objs_per_zspage;
 
 	error = 0; /* Success */
 
@@ -425,6 +470,53 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+static unsigned long obj_malloc(struct size_class *class,
+				struct page *first_page, unsigned long handle)
+{
+	unsigned long obj, m_objidx, m_offset;
+	struct link_free *link;
+	struct page *m_page;
+	void *vaddr;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	vaddr = kmap_atomic(m_page);
+	link = (struct link_free *)(vaddr + m_offset);
+	first_page->freelist = (void *)link->next;
+	/* Back-reference used by compaction to update the handle */
+	link->handle = handle | OBJ_ALLOCATED_TAG;
+	kunmap_atomic(vaddr);
+
+	first_page->inuse++;
+	class->obj_used++;
+
+	return obj;
+}
+
+/* Called with class->lock held; caller fixes the fullness group */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	unsigned long f_objidx, f_offset;
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	void *vaddr;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	/* Insert this object in containing zspage's freelist */
+	vaddr = kmap_atomic(f_page);
+	link = (struct link_free *)(vaddr + f_offset);
+	link->next = (unsigned long)first_page->freelist;
+	kunmap_atomic(vaddr);
+	first_page->freelist = (void *)obj;
+
+	first_page->inuse--;
+	class->obj_used--;
+}
 
 static int zs_cpu_notifier(struct notifier_block *nb, unsigned long action,
 				void *pcpu)
@@ -457,6 +549,123 @@ static struct notifier_block zs_cpu_nb = {
 	.notifier_call = zs_cpu_notifier
 };
 
+#ifdef CONFIG_ZSMALLOC_STAT
+
+static struct dentry *zs_stat_root;
+
+static int zs_stats_size_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	struct size_class *class;
+	unsigned long almost_full, almost_empty;
+	unsigned long obj_allocated, obj_used, freeable;
+	u64 pages_used;
+	unsigned long total_objs = 0, total_used_objs = 0;
+	unsigned long total_freeable = 0;
+	u64 total_pages = 0;
+
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s %8s\n",
+			"class", "size", "almost_full", "almost_empty",
+			"obj_allocated", "obj_used", "pages_used",
+			"pages_per_zspage", "freeable");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		almost_full = class->nr_zspages[ZS_ALMOST_FULL];
+		almost_empty = class->nr_zspages[ZS_ALMOST_EMPTY];
+		obj_allocated = class->obj_allocated;
+		obj_used = class->obj_used;
+		pages_used = class->pages_allocated;
+		spin_unlock(&class->lock);
+
+		if (!obj_allocated)
+			continue;
+
+		freeable = (obj_allocated - obj_used) /
+				class->objs_per_zspage * class->zspage_order;
+
+		seq_printf(s, " %5u %5u %11lu %12lu %13lu %10lu %10llu %16d %8lu\n",
+			i, class->size, almost_full, almost_empty,
+			obj_allocated, obj_used, pages_used,
+			class->zspage_order, freeable);
+
+		total_objs += obj_allocated;
+		total_used_objs += obj_used;
+		total_pages += pages_used;
+		total_freeable += freeable;
+	}
+
+	seq_puts(s, "\n");
+	seq_printf(s, " %5s %5s %11s %12s %13lu %10lu %10llu %16s %8lu\n",
+			"Total", "", "", "", total_objs, total_used_objs,
+			total_pages, "", total_freeable);
+	seq_printf(s, "\n pages_compacted: %lu\n",
+			atomic_long_read(&pool->pages_compacted));
+
+	return 0;
+}
+
+static int zs_stats_size_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_size_show, inode->i_private);
+}
+
+static const struct file_operations zs_stat_size_ops = {
+	.open		= zs_stats_size_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	struct dentry *entry;
+
+	if (!zs_stat_root)
+		return;
+
+	entry = debugfs_create_dir(pool->name, zs_stat_root);
+	if (!entry) {
+		pr_warning("debugfs dir <%s> creation failed\n", pool->name);
+		return;
+	}
+	pool->stat_dentry = entry;
+
+	if (!debugfs_create_file("classes", S_IFREG | S_IRUGO,
+				pool->stat_dentry, pool, &zs_stat_size_ops))
+		pr_warning("%s: debugfs file entry <classes> creation "
+			"failed\n", pool->name);
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->stat_dentry);
+}
+
+static void __init zs_stat_init(void)
+{
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+	if (!zs_stat_root)
+		pr_warning("debugfs 'zsmalloc' stat dir creation failed\n");
+}
+
+static void zs_stat_exit(void)
+{
+	debugfs_remove_recursive(zs_stat_root);
+}
+
+#else /* CONFIG_ZSMALLOC_STAT */
+
+static inline void zs_pool_stat_create(struct zs_pool *pool) { }
+static inline void zs_pool_stat_destroy(struct zs_pool *pool) { }
+static inline void zs_stat_init(void) { }
+static inline void zs_stat_exit(void) { }
+
+#endif /* CONFIG_ZSMALLOC_STAT */
+
 static void zs_exit(void)
 {
 	int cpu;
@@ -464,6 +673,8 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	zs_stat_exit();
 }
 
 static int zs_init(void)
@@ -476,12 +687,272 @@ static int zs_init(void)
 		if (notifier_to_errno(ret))
 			goto fail;
 	}
+
+	zs_stat_init();
 	return 0;
 fail:
 	zs_exit();
 	return notifier_to_errno(ret);
 }
 
+/*
+ * Compaction
+ *
+ * Objects are moved out of ZS_ALMOST_EMPTY zspages into the fullest
+ * zspages of the same class, and source zspages that end up empty are
+ * freed. Users only hold handles, which are updated in place, so
+ * nothing outside zsmalloc notices an object moving. Objects that are
+ * mapped (pinned) at the time are left alone.
+ */
+
+/* Number of zspages that compaction could free in @class */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	return (class->obj_allocated - class->obj_used) /
+		class->objs_per_zspage;
+}
+
+/*
+ * Copy a whole object, header included. Both source and destination
+ * may span two pages.
+ */
+static void zs_object_copy(unsigned long dst, unsigned long src,
+				struct size_class *class)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx;
+	unsigned long s_off, d_off;
+	void *s_addr, *d_addr;
+	int s_size, d_size, size;
+	int written = 0;
+
+	s_size = d_size = class->size;
+
+	obj_to_location(src, &s_page, &s_objidx);
+	obj_to_location(dst, &d_page, &d_objidx);
+
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	if (s_off + class->size > PAGE_SIZE)
+		s_size = PAGE_SIZE - s_off;
+
+	if (d_off + class->size > PAGE_SIZE)
+		d_size = PAGE_SIZE - d_off;
+
+	s_addr = kmap_atomic(s_page);
+	d_addr = kmap_atomic(d_page);
+
+	while (1) {
+		size = min(s_size, d_size);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		written += size;
+
+		if (written == class->size)
+			break;
+
+		s_off += size;
+		s_size -= size;
+		d_off += size;
+		d_size -= size;
+
+		if (s_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			kunmap_atomic(s_addr);
+			s_page = get_next_page(s_page);
+			BUG_ON(!s_page);
+			s_addr = kmap_atomic(s_page);
+			d_addr = kmap_atomic(d_page);
+			s_size = class->size - written;
+			s_off = 0;
+		}
+
+		if (d_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			d_page = get_next_page(d_page);
+			BUG_ON(!d_page);
+			d_addr = kmap_atomic(d_page);
+			d_size = class->size - written;
+			d_off = 0;
+		}
+	}
+
+	kunmap_atomic(d_addr);
+	kunmap_atomic(s_addr);
+}
+
+/*
+ * Return the handle of the first allocated object in @page at or after
+ * index *obj_idx, or 0 if there is none. *obj_idx is updated to the
+ * index of the returned object.
+ */
+static unsigned long find_alloced_obj(struct page *page, int *obj_idx,
+				struct size_class *class)
+{
+	unsigned long head, handle = 0;
+	unsigned long offset = 0;
+	unsigned long limit = PAGE_SIZE;
+	int index = *obj_idx;
+	void *addr;
+
+	if (!is_first_page(page))
+		offset = page->index;
+	offset += class->size * index;
+
+	/* The tail of the last page may hold no (whole) object */
+	if (is_last_page(page))
+		limit = PAGE_SIZE - class->size + 1;
+
+	addr = kmap_atomic(page);
+	while (offset < limit) {
+		head = *(unsigned long *)(addr + offset);
+		if (head & OBJ_ALLOCATED_TAG) {
+			handle = head & ~OBJ_ALLOCATED_TAG;
+			break;
+		}
+		offset += class->size;
+		index++;
+	}
+	kunmap_atomic(addr);
+
+	*obj_idx = index;
+	return handle;
+}
+
+/*
+ * Move objects out of @src_page, which the caller has taken off its
+ * fullness list, into other zspages of @class. Stops early if no other
+ * zspage has room or an object is pinned. Called with class->lock held.
+ */
+static void zs_migrate_zspage(struct zs_pool *pool, struct size_class *class,
+				struct page *src_page)
+{
+	struct page *s_page = src_page, *d_page;
+	unsigned long handle, used_obj, free_obj;
+	int obj_idx = 0;
+
+	while (s_page) {
+		handle = find_alloced_obj(s_page, &obj_idx, class);
+		if (!handle) {
+			s_page = get_next_page(s_page);
+			obj_idx = 0;
+			continue;
+		}
+
+		d_page = find_get_zspage(class);
+		if (!d_page)
+			break;
+
+		/* Object is mapped or being freed right now */
+		if (!trypin_tag(handle))
+			break;
+
+		used_obj = handle_to_obj(handle);
+		free_obj = obj_malloc(class, d_page, handle);
+		zs_object_copy(free_obj, used_obj, class);
+		record_obj(handle, free_obj);
+		unpin_tag(handle);
+		obj_free(class, used_obj);
+
+		fix_fullness_group(pool, d_page);
+		obj_idx++;
+	}
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	enum fullness_group fg;
+	struct page *src_page;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		src_page = class->fullness_list[ZS_ALMOST_EMPTY];
+		if (!src_page)
+			break;
+
+		/* Keep src_page from being picked as a destination */
+		remove_zspage(src_page, class, ZS_ALMOST_EMPTY);
+		zs_migrate_zspage(pool, class, src_page);
+
+		fg = get_fullness_group(src_page);
+		set_zspage_mapping(src_page, class->index, fg);
+		if (fg != ZS_EMPTY) {
+			/* Could not empty it: nothing more to gain here */
+			insert_zspage(src_page, class, fg);
+			break;
+		}
+
+		class->pages_allocated -= class->zspage_order;
+		class->obj_allocated -= class->objs_per_zspage;
+		spin_unlock(&class->lock);
+
+		free_zspage(src_page);
+		freed += class->zspage_order;
+
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Free zspages by moving objects out of sparse ones.
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+unsigned long zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
+
+static unsigned long zs_freeable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+	struct size_class *class;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		spin_lock(&class->lock);
+		pages += zs_can_compact(class) * class->zspage_order;
+		spin_unlock(&class->lock);
+	}
+
+	return pages;
+}
+
+static int zs_shrinker_scan(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	return min_t(unsigned long, zs_freeable_pages(pool), INT_MAX);
+}
+
 struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 {
 	int i, ovhd_size;
@@ -495,6 +966,13 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	if (!pool)
 		return NULL;
 
+	pool->handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+						0, 0, NULL);
+	if (!pool->handle_cachep) {
+		kfree(pool);
+		return NULL;
+	}
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int size;
 		struct size_class *class;
@@ -508,12 +986,20 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 		class->index = i;
 		spin_lock_init(&class->lock);
 		class->zspage_order = get_zspage_order(size);
+		class->objs_per_zspage = class->zspage_order * PAGE_SIZE /
+						class->size;
 
 	}
 
 	pool->flags = flags;
 	pool->name = name;
 
+	pool->shrinker.shrink = zs_shrinker_scan;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	zs_pool_stat_create(pool);
+
 	return pool;
 }
 EXPORT_SYMBOL_GPL(zs_create_pool);
@@ -522,6 +1008,9 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	unregister_shrinker(&pool->shrinker);
+	zs_pool_stat_destroy(pool);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -534,6 +1023,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 			}
 		}
 	}
+	kmem_cache_destroy(pool->handle_cachep);
 	kfree(pool);
 }
 EXPORT_SYMBOL_GPL(zs_destroy_pool);
@@ -542,28 +1032,30 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  * zs_malloc - Allocate block of given size from pool.
  * @pool: pool to allocate from
  * @size: size of block to allocate
- * @page: page no. that holds the object
- * @offset: location of object within page
  *
- * On success, <page, offset> identifies block allocated
- * and 0 is returned. On failure, <page, offset> is set to
- * 0 and -ENOMEM is returned.
+ * On success, a handle to the allocated block is returned; it stays
+ * valid even if compaction moves the block. On failure, NULL is
+ * returned.
  *
- * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
  */
 void *zs_malloc(struct zs_pool *pool, size_t size)
 {
-	void *obj;
-	struct link_free *link;
+	unsigned long handle, obj;
 	int class_idx;
 	struct size_class *class;
+	struct page *first_page;
 
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return NULL;
 
-	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+	handle = alloc_handle(pool);
+	if (!handle)
 		return NULL;
 
+	/* extra space in chunk to keep the handle */
+	size += ZS_HANDLE_SIZE;
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -574,79 +1066,77 @@ void *zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			free_handle(pool, handle);
 			return NULL;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->zspage_order;
+		class->obj_allocated += class->objs_per_zspage;
 	}
 
-	obj = first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(class, first_page, handle);
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
+	record_obj(handle, obj);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return (void *)handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, void *obj)
+void zs_free(struct zs_pool *pool, void *obj_handle)
 {
-	struct link_free *link;
+	unsigned long handle = (unsigned long)obj_handle;
+	unsigned long obj, f_objidx;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* Keep compaction from moving the object under us */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
 
-	if (fullness == ZS_EMPTY)
+	if (fullness == ZS_EMPTY) {
 		class->pages_allocated -= class->zspage_order;
+		class->obj_allocated -= class->objs_per_zspage;
+	}
 
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	free_handle(pool, handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
-void *zs_map_object(struct zs_pool *pool, void *handle)
+/*
+ * The object stays pinned, and so cannot be moved by compaction,
+ * until zs_unmap_object().
+ */
+void *zs_map_object(struct zs_pool *pool, void *obj_handle)
 {
+	unsigned long handle = (unsigned long)obj_handle;
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -655,7 +1145,10 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	pin_tag(handle);
+
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -679,14 +1172,16 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 		area->vm_addr = area->vm->addr;
 	}
 
-	return area->vm_addr + off;
+	/* Skip the handle stored at the start of the object */
+	return area->vm_addr + off + ZS_HANDLE_SIZE;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
-void zs_unmap_object(struct zs_pool *pool, void *handle)
+void zs_unmap_object(struct zs_pool *pool, void *obj_handle)
 {
+	unsigned long handle = (unsigned long)obj_handle;
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -695,7 +1190,8 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -710,6 +1206,8 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 		__flush_tlb_one((unsigned long)area->vm_addr + PAGE_SIZE);
 	}
 	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
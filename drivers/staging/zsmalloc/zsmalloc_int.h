@@ -14,6 +14,7 @@
 #define _ZS_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/shrinker.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -34,13 +35,19 @@
 
 /*
  * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * as single unsigned long value ('obj').
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
  * to a zspage, obj_idx starts with 0.
  *
  * This is made more complicated by various memory models and PAE.
+ *
+ * The low OBJ_TAG_BITS of an obj are always zero. This lets the first
+ * word of an object tell a free object (holding the obj of the next
+ * free object) from an allocated one (holding its handle, tagged with
+ * OBJ_ALLOCATED_TAG), and lets a handle's pin bit share the word
+ * that stores its obj.
  */
 
 #ifndef MAX_PHYSMEM_BITS
@@ -55,7 +62,8 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
@@ -64,6 +72,18 @@
 	MAX(32, (ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT >> OBJ_INDEX_BITS))
 #define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
 
+/*
+ * A handle is the address of a word (allocated from the pool's
+ * handle cache) that stores the current obj of an allocation, so
+ * compaction can move the object without the user noticing. Every
+ * allocated object starts with its handle, which costs ZS_HANDLE_SIZE
+ * bytes per object.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1
+/* Set while a handle is mapped or being migrated */
+#define HANDLE_PIN_BIT		0
+
 /*
  * On systems with 4K page size, this gives 254 size classes! There is a
  * trader-off here:
@@ -126,10 +146,16 @@ struct size_class {
 	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
 	int zspage_order;
 
+	/* Number of objects that fit in a zspage */
+	int objs_per_zspage;
+
 	spinlock_t lock;
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long obj_allocated;	/* capacity of all zspages */
+	unsigned long obj_used;
+	unsigned long nr_zspages[_ZS_NR_FULLNESS_GROUPS];
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
@@ -141,15 +167,28 @@ struct size_class {
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* obj of next free chunk (encodes <PFN, obj_idx>) */
+		unsigned long next;
+		/* Handle of an allocated object, | OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
 };
 
 struct zs_pool {
 	struct size_class size_class[ZS_SIZE_CLASSES];
 
+	struct kmem_cache *handle_cachep;
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+
+	/* Compaction */
+	struct shrinker shrinker;
+	atomic_long_t pages_compacted;
+
+#ifdef CONFIG_ZSMALLOC_STAT
+	struct dentry *stat_dentry;
+#endif
 };
 
 #endif
@@ -102,7 +102,8 @@ struct request {
 	struct gendisk *rq_disk;
 	struct hd_struct *part;
 	unsigned long start_time;
-#ifdef CONFIG_BLK_CGROUP
+#if defined(CONFIG_BLK_CGROUP) || IS_ENABLED(CONFIG_IOSCHED_BFQ) || \
+	defined(CONFIG_BLK_DEV_LAT_HIST)
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    
 #endif
@@ -316,6 +317,10 @@ struct request_queue {
 	
 	struct throtl_data *td;
 #endif
+#ifdef CONFIG_BLK_DEV_LAT_HIST
+	struct blk_lat_hist __percpu *lat_hist;
+#endif
+	struct blk_sw_queue __percpu *sw_queues;
 };
 
 #define QUEUE_FLAG_QUEUED	1	
@@ -338,6 +343,7 @@ struct request_queue {
 #define QUEUE_FLAG_SECDISCARD  17	
 #define QUEUE_FLAG_SAME_FORCE  18	
 #define QUEUE_FLAG_SANITIZE    19	
+#define QUEUE_FLAG_SW_QUEUES   20	
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_STACKABLE)	|	\
@@ -418,6 +424,8 @@ static inline void queue_flag_clear(unsigned int flag, struct request_queue *q)
 	test_bit(QUEUE_FLAG_STACKABLE, &(q)->queue_flags)
 #define blk_queue_discard(q)	test_bit(QUEUE_FLAG_DISCARD, &(q)->queue_flags)
 #define blk_queue_sanitize(q)	test_bit(QUEUE_FLAG_SANITIZE, &(q)->queue_flags)
+#define blk_queue_sw_queues(q)	\
+	test_bit(QUEUE_FLAG_SW_QUEUES, &(q)->queue_flags)
 #define blk_queue_secdiscard(q)	(blk_queue_discard(q) && \
 	test_bit(QUEUE_FLAG_SECDISCARD, &(q)->queue_flags))
 
@@ -1010,7 +1018,8 @@ static inline void put_dev_sector(Sector p)
 struct work_struct;
 int kblockd_schedule_work(struct request_queue *q, struct work_struct *work);
 
-#ifdef CONFIG_BLK_CGROUP
+#if defined(CONFIG_BLK_CGROUP) || IS_ENABLED(CONFIG_IOSCHED_BFQ) || \
+	defined(CONFIG_BLK_DEV_LAT_HIST)
 static inline void set_start_time_ns(struct request *req)
 {
 	preempt_disable();
@@ -708,6 +708,14 @@ struct file_ra_state {
 	unsigned int ra_pages;		
 	unsigned int mmap_miss;		
 	loff_t prev_pos;		
+
+	pgoff_t demand;
+	unsigned int demand_size;
+	pgoff_t last_miss;
+	int stride;
+	unsigned int stride_count:4;
+	unsigned int shift:2;
+	unsigned int hit:1;
 };
 
 static inline int ra_has_index(struct file_ra_state *ra, pgoff_t index)
@@ -716,6 +724,13 @@ static inline int ra_has_index(struct file_ra_state *ra, pgoff_t index)
 		index <  ra->start + ra->size);
 }
 
+static inline void ra_mark_hit(struct file_ra_state *ra, pgoff_t index)
+{
+	if (!ra->hit && ra_has_index(ra, index) &&
+	    (index < ra->demand || index - ra->demand >= ra->demand_size))
+		ra->hit = 1;
+}
+
 #define FILE_MNT_WRITE_TAKEN	1
 #define FILE_MNT_WRITE_RELEASED	2
 
@@ -50,6 +50,25 @@ enum oom_scan_t {
 extern void compare_swap_oom_score_adj(int old_val, int new_val);
 extern int test_set_oom_score_adj(int new_val);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/* Keep the lowmemorykiller's per-oom_score_adj process lists up to date */
+extern void lowmem_adj_add_task(struct task_struct *p);
+extern void lowmem_adj_del_task(struct task_struct *p);
+extern void lowmem_adj_update_task(struct task_struct *p);
+#else
+static inline void lowmem_adj_add_task(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_del_task(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_update_task(struct task_struct *p)
+{
+}
+#endif
+
 extern unsigned long oom_badness(struct task_struct *p,
 		struct mem_cgroup *memcg, const nodemask_t *nodemask,
 		unsigned long totalpages);
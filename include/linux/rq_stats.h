@@ -29,3 +29,7 @@ struct rq_data {
 extern spinlock_t rq_lock;
 extern struct rq_data rq_info;
 extern struct workqueue_struct *rq_wq;
+
+/* read and restart the averaging windows, in tenths and percent */
+unsigned int msm_rq_stats_read_avg(void);
+unsigned int msm_rq_stats_cpu_load(unsigned int cpu);
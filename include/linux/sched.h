@@ -952,6 +952,13 @@ struct sched_statistics {
 };
 #endif
 
+struct sched_avg {
+	u32 runnable_avg_sum, runnable_avg_period;
+	u64 last_runnable_update;
+	unsigned long load_avg_contrib;
+	unsigned long util_avg_contrib;
+};
+
 struct sched_entity {
 	struct load_weight	load;		
 	struct rb_node		run_node;
@@ -976,6 +983,10 @@ struct sched_entity {
 	
 	struct cfs_rq		*my_q;
 #endif
+
+#ifdef CONFIG_SMP
+	struct sched_avg	avg;
+#endif
 };
 
 struct sched_rt_entity {
@@ -1058,6 +1069,9 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct hlist_node lowmem_adj_node;
+#endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
@@ -2362,6 +2376,19 @@ static inline unsigned long task_get_effective_timer_slack(
 }
 #endif
 
+#ifdef CONFIG_CPU_FREQ
+/*
+ * Called by the scheduler with the rq lock held whenever the utilization
+ * of a cpu may have changed; util > max means run as fast as possible.
+ */
+struct update_util_data {
+	void (*func)(struct update_util_data *data, u64 time,
+		     unsigned long util, unsigned long max);
+};
+
+void cpufreq_set_update_util_data(int cpu, struct update_util_data *data);
+#endif
+
 #endif 
 
 #endif
@@ -178,83 +178,108 @@ static inline void check_for_tasks(int cpu)
 	write_unlock_irq(&tasklist_lock);
 }
 
-struct take_cpu_down_param {
-	unsigned long mod;
-	void *hcpu;
-};
+/* serialized by cpu_add_remove_lock */
+static struct cpumask cpus_prepared;
+static struct cpumask cpus_dying;
 
+/*
+ * Runs on every cpu of a batch inside one stop_machine, in cpu order, so
+ * that only one of them is between __cpu_disable() and the end of its
+ * CPU_DYING notifiers at any time.
+ */
 static int __ref take_cpu_down(void *_param)
 {
-	struct take_cpu_down_param *param = _param;
+	unsigned long mod = *(unsigned long *)_param;
+	unsigned int cpu = smp_processor_id();
 	int err;
 
-	
+	while (cpumask_first(&cpus_dying) != cpu)
+		cpu_relax();
+
 	err = __cpu_disable();
-	if (err < 0)
-		return err;
+	if (!err)
+		cpu_notify(CPU_DYING | mod, (void *)(long)cpu);
 
-	cpu_notify(CPU_DYING | param->mod, param->hcpu);
-	return 0;
+	smp_mb__before_clear_bit();
+	cpumask_clear_cpu(cpu, &cpus_dying);
+	return err < 0 ? err : 0;
 }
 
 int skip_cpu_offline = 0;
-static int __ref _cpu_down(unsigned int cpu, int tasks_frozen)
+static int __ref _cpus_down(const struct cpumask *cpus, int tasks_frozen)
 {
-	int err, nr_calls = 0;
-	void *hcpu = (void *)(long)cpu;
+	int err, nr_calls;
+	unsigned int cpu;
 	unsigned long mod = tasks_frozen ? CPU_TASKS_FROZEN : 0;
-	struct take_cpu_down_param tcd_param = {
-		.mod = mod,
-		.hcpu = hcpu,
-	};
 
 	if (skip_cpu_offline)
 		return -EACCES;
 
-	if (num_online_cpus() == 1)
-		return -EBUSY;
-
-	if (!cpu_online(cpu))
+	if (cpumask_empty(cpus) || !cpumask_subset(cpus, cpu_online_mask))
 		return -EINVAL;
 
+	if (cpumask_weight(cpus) >= num_online_cpus())
+		return -EBUSY;
+
 	cpu_hotplug_begin();
 
-	err = __cpu_notify(CPU_DOWN_PREPARE | mod, hcpu, -1, &nr_calls);
-	if (err) {
-		nr_calls--;
-		__cpu_notify(CPU_DOWN_FAILED | mod, hcpu, nr_calls, NULL);
-		printk("%s: attempt to take down CPU %u failed\n",
-				__func__, cpu);
-		goto out_release;
+	cpumask_clear(&cpus_prepared);
+	for_each_cpu(cpu, cpus) {
+		nr_calls = 0;
+		err = __cpu_notify(CPU_DOWN_PREPARE | mod, (void *)(long)cpu,
+				   -1, &nr_calls);
+		if (err) {
+			nr_calls--;
+			__cpu_notify(CPU_DOWN_FAILED | mod, (void *)(long)cpu,
+				     nr_calls, NULL);
+			printk("%s: attempt to take down CPU %u failed\n",
+					__func__, cpu);
+			for_each_cpu(cpu, &cpus_prepared)
+				cpu_notify_nofail(CPU_DOWN_FAILED | mod,
+						  (void *)(long)cpu);
+			cpumask_clear(&cpus_prepared);
+			goto out_release;
+		}
+		cpumask_set_cpu(cpu, &cpus_prepared);
 	}
 
-	err = __stop_machine(take_cpu_down, &tcd_param, cpumask_of(cpu));
-	if (err) {
-		
-		cpu_notify_nofail(CPU_DOWN_FAILED | mod, hcpu);
-
-		goto out_release;
-	}
-	BUG_ON(cpu_online(cpu));
+	/*
+	 * Only __cpu_disable() and the CPU_DYING notifiers run with the
+	 * machine stopped, once for the whole batch.
+	 */
+	cpumask_copy(&cpus_dying, cpus);
+	err = __stop_machine(take_cpu_down, &mod, cpus);
+
+	for_each_cpu(cpu, cpus) {
+		if (cpu_online(cpu)) {
+			cpu_notify_nofail(CPU_DOWN_FAILED | mod,
+					  (void *)(long)cpu);
+			cpumask_clear_cpu(cpu, &cpus_prepared);
+			continue;
+		}
 
-	while (!idle_cpu(cpu))
-		cpu_relax();
+		while (!idle_cpu(cpu))
+			cpu_relax();
 
-	
-	__cpu_die(cpu);
+		__cpu_die(cpu);
 
-	
-	cpu_notify_nofail(CPU_DEAD | mod, hcpu);
+		cpu_notify_nofail(CPU_DEAD | mod, (void *)(long)cpu);
 
-	check_for_tasks(cpu);
+		check_for_tasks(cpu);
+	}
 
 out_release:
 	cpu_hotplug_done();
-	if (!err)
-		cpu_notify_nofail(CPU_POST_DEAD | mod, hcpu);
+	for_each_cpu(cpu, &cpus_prepared)
+		cpu_notify_nofail(CPU_POST_DEAD | mod, (void *)(long)cpu);
 	return err;
 }
 
+static int __ref _cpu_down(unsigned int cpu, int tasks_frozen)
+{
+	return _cpus_down(cpumask_of(cpu), tasks_frozen);
+}
+
 extern void trace_cpu_down_frequency (unsigned int cpu);
 int __ref cpu_down(unsigned int cpu)
 {
@@ -279,6 +304,33 @@ out:
 	return err;
 }
 EXPORT_SYMBOL(cpu_down);
+
+/**
+ * cpus_down - take several cpus offline at once
+ * @cpus: the cpus to take down, all of them online
+ *
+ * Like cpu_down() on each of @cpus, but the machine is stopped only once
+ * for the whole set. Returns 0 if all of them went down; on error the
+ * ones that did go down stay offline.
+ */
+int __ref cpus_down(const struct cpumask *cpus)
+{
+	int err;
+
+	cpu_maps_update_begin();
+
+	if (cpu_hotplug_disabled) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	err = _cpus_down(cpus, 0);
+
+out:
+	cpu_maps_update_done();
+	return err;
+}
+EXPORT_SYMBOL(cpus_down);
 #endif 
 
 static int __cpuinit _cpu_up(unsigned int cpu, int tasks_frozen)
@@ -389,7 +441,7 @@ void __weak arch_disable_nonboot_cpus_end(void)
 
 int disable_nonboot_cpus(void)
 {
-	int cpu, first_cpu, error = 0;
+	int first_cpu, error = 0;
 
 	cpu_maps_update_begin();
 	first_cpu = cpumask_first(cpu_online_mask);
@@ -397,17 +449,13 @@ int disable_nonboot_cpus(void)
 	arch_disable_nonboot_cpus_begin();
 
 	printk("Disabling non-boot CPUs ...\n");
-	for_each_online_cpu(cpu) {
-		if (cpu == first_cpu)
-			continue;
-		error = _cpu_down(cpu, 1);
-		if (!error)
-			cpumask_set_cpu(cpu, frozen_cpus);
-		else {
-			printk(KERN_ERR "Error taking CPU%d down: %d\n",
-				cpu, error);
-			break;
-		}
+	cpumask_copy(frozen_cpus, cpu_online_mask);
+	cpumask_clear_cpu(first_cpu, frozen_cpus);
+	if (!cpumask_empty(frozen_cpus)) {
+		error = _cpus_down(frozen_cpus, 1);
+		if (error)
+			printk(KERN_ERR "Error taking CPUs down: %d\n", error);
+		cpumask_andnot(frozen_cpus, frozen_cpus, cpu_online_mask);
 	}
 
 	arch_disable_nonboot_cpus_end();
@@ -71,6 +71,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 		detach_pid(p, PIDTYPE_SID);
 
 		list_del_rcu(&p->tasks);
+		lowmem_adj_del_task(p);
 		list_del_init(&p->sibling);
 		__this_cpu_dec(process_counts);
 	}
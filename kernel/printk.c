@@ -1061,7 +1061,6 @@ static int __cpuinit console_cpu_notify(struct notifier_block *self,
 		console_unlock();
 		break;
 	case CPU_ONLINE:
-	case CPU_DYING:
 		
 		if (!console_trylock())
 			schedule_work(&console_cpu_notify_work);
@@ -1340,6 +1340,10 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_SMP
+	memset(&p->se.avg, 0, sizeof(p->se.avg));
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -1882,7 +1886,7 @@ decay_load_missed(unsigned long load, unsigned long missed_updates, int idx)
 
 void update_cpu_load(struct rq *this_rq)
 {
-	unsigned long this_load = this_rq->load.weight;
+	unsigned long this_load = rq_runnable_load(this_rq);
 	unsigned long curr_jiffies = jiffies;
 	unsigned long pending_updates;
 	int i, scale;
@@ -0,0 +1,25 @@
+/*
+ * Scheduler hooks for cpufreq governors
+ *
+ * A governor registers an update_util_data per cpu; the scheduler calls
+ * it from enqueue, dequeue and tick with the rq lock held. Pointers are
+ * published with RCU-sched, so after clearing them a governor must call
+ * synchronize_sched() before freeing its data.
+ */
+
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/module.h>
+
+#include "sched.h"
+
+DEFINE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+void cpufreq_set_update_util_data(int cpu, struct update_util_data *data)
+{
+	if (WARN_ON(data && !data->func))
+		return;
+
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), data);
+}
+EXPORT_SYMBOL_GPL(cpufreq_set_update_util_data);
@@ -789,6 +789,250 @@ static inline void update_entity_shares_tick(struct cfs_rq *cfs_rq)
 }
 #endif 
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity load tracking.
+ *
+ * Each sched_entity keeps a geometric series of the time it was runnable,
+ * in ~1ms (1024us) periods, where the contribution of a period p periods
+ * ago is scaled by y^p with y^32 = 1/2. Its load contribution is its
+ * weight scaled by the runnable fraction of that series, and the
+ * contributions of the entities queued on a cfs_rq add up to its
+ * runnable_load_avg. Group entities are tracked like tasks, so their
+ * contribution, and the one of their tasks, propagates up the hierarchy.
+ */
+#define LOAD_AVG_PERIOD 32
+#define LOAD_AVG_MAX 47742
+#define LOAD_AVG_MAX_N 345
+
+/* y^n, n < LOAD_AVG_PERIOD, scaled by 2^32 */
+static const u32 runnable_avg_yN_inv[] = {
+	0xffffffff, 0xfa83b2da, 0xf5257d14, 0xefe4b99a, 0xeac0c6e6, 0xe5b906e6,
+	0xe0ccdeeb, 0xdbfbb796, 0xd744fcc9, 0xd2a81d91, 0xce248c14, 0xc9b9bd85,
+	0xc5672a10, 0xc12c4cc9, 0xbd08a39e, 0xb8fbaf46, 0xb504f333, 0xb123f581,
+	0xad583ee9, 0xa9a15ab4, 0xa5fed6a9, 0xa2704302, 0x9ef5325f, 0x9b8d39b9,
+	0x9837f050, 0x94f4efa8, 0x91c3d373, 0x8ea4398a, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/* sum of 1024 * y^k for k = 1..n */
+static const u32 runnable_avg_yN_sum[] = {
+	    0, 1002, 1982, 2941, 3880, 4798, 5697, 6576, 7437, 8279, 9103,
+	 9909, 10698, 11470, 12226, 12966, 13690, 14398, 15091, 15769, 16433,
+	17082, 17718, 18340, 18949, 19545, 20128, 20698, 21256, 21802, 22336,
+	22859, 23371,
+};
+
+/* val * y^n */
+static __always_inline u64 decay_load(u64 val, u64 n)
+{
+	unsigned int local_n;
+
+	if (!n)
+		return val;
+	else if (unlikely(n > LOAD_AVG_PERIOD * 63))
+		return 0;
+
+	local_n = n;
+	if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+		val >>= local_n / LOAD_AVG_PERIOD;
+		local_n %= LOAD_AVG_PERIOD;
+	}
+
+	val *= runnable_avg_yN_inv[local_n];
+	return val >> 32;
+}
+
+/* contribution of n full periods of runnable time */
+static u32 __compute_runnable_contrib(u64 n)
+{
+	u32 contrib = 0;
+
+	if (likely(n <= LOAD_AVG_PERIOD))
+		return runnable_avg_yN_sum[n];
+	else if (unlikely(n >= LOAD_AVG_MAX_N))
+		return LOAD_AVG_MAX;
+
+	do {
+		contrib /= 2;
+		contrib += runnable_avg_yN_sum[LOAD_AVG_PERIOD];
+		n -= LOAD_AVG_PERIOD;
+	} while (n > LOAD_AVG_PERIOD);
+
+	contrib = decay_load(contrib, n);
+	return contrib + runnable_avg_yN_sum[n];
+}
+
+/*
+ * Account the time since the last update as runnable or not, decaying
+ * the series for each period boundary crossed. Returns whether any
+ * boundary was crossed.
+ */
+static __always_inline int __update_entity_runnable_avg(u64 now,
+							struct sched_avg *sa,
+							int runnable)
+{
+	u64 delta, periods;
+	u32 runnable_contrib;
+	int delta_w, decayed = 0;
+
+	delta = now - sa->last_runnable_update;
+	if ((s64)delta < 0) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	delta >>= 10;
+	if (!delta)
+		return 0;
+	sa->last_runnable_update = now;
+
+	delta_w = sa->runnable_avg_period % 1024;
+	if (delta + delta_w >= 1024) {
+		decayed = 1;
+
+		delta_w = 1024 - delta_w;
+		if (runnable)
+			sa->runnable_avg_sum += delta_w;
+		sa->runnable_avg_period += delta_w;
+
+		delta -= delta_w;
+
+		periods = delta / 1024;
+		delta %= 1024;
+
+		sa->runnable_avg_sum = decay_load(sa->runnable_avg_sum,
+						  periods + 1);
+		sa->runnable_avg_period = decay_load(sa->runnable_avg_period,
+						     periods + 1);
+
+		runnable_contrib = __compute_runnable_contrib(periods);
+		if (runnable)
+			sa->runnable_avg_sum += runnable_contrib;
+		sa->runnable_avg_period += runnable_contrib;
+	}
+
+	if (runnable)
+		sa->runnable_avg_sum += delta;
+	sa->runnable_avg_period += delta;
+
+	return decayed;
+}
+
+/* recompute the load contribution of se, return its change */
+static long __update_entity_load_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.load_avg_contrib;
+	u64 contrib;
+
+	contrib = (u64)se->avg.runnable_avg_sum *
+		  scale_load_down(se->load.weight);
+	contrib = div_u64(contrib, se->avg.runnable_avg_period + 1);
+	se->avg.load_avg_contrib = scale_load(contrib);
+
+	return se->avg.load_avg_contrib - old_contrib;
+}
+
+/* same for the runnable fraction alone, scaled to SCHED_POWER_SCALE */
+static long __update_entity_util_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.util_avg_contrib;
+
+	se->avg.util_avg_contrib = div_u64((u64)se->avg.runnable_avg_sum <<
+					   SCHED_POWER_SHIFT,
+					   se->avg.runnable_avg_period + 1);
+
+	return se->avg.util_avg_contrib - old_contrib;
+}
+
+static void update_entity_load_avg(struct sched_entity *se)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	long contrib_delta, util_delta;
+
+	if (!__update_entity_runnable_avg(rq_of(cfs_rq)->clock, &se->avg,
+					  se->on_rq))
+		return;
+
+	contrib_delta = __update_entity_load_avg_contrib(se);
+	util_delta = __update_entity_util_avg_contrib(se);
+	if (se->on_rq) {
+		cfs_rq->runnable_load_avg += contrib_delta;
+		cfs_rq->runnable_util_avg += util_delta;
+	}
+}
+
+/* called before se is queued: decay it over the time it was not */
+static void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+				    struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
+	cfs_rq->runnable_util_avg += se->avg.util_avg_contrib;
+}
+
+/* called before se is dequeued */
+static void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+				    struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	cfs_rq->runnable_load_avg -= min(cfs_rq->runnable_load_avg,
+					 se->avg.load_avg_contrib);
+	cfs_rq->runnable_util_avg -= min(cfs_rq->runnable_util_avg,
+					 se->avg.util_avg_contrib);
+}
+
+/*
+ * New tasks start with a full slice of runnable history, so that they are
+ * not taken for idle ones until they have run for a while.
+ */
+static void init_task_runnable_average(struct cfs_rq *cfs_rq,
+				       struct task_struct *p)
+{
+	u32 slice = sched_slice(cfs_rq, &p->se) >> 10;
+
+	p->se.avg.runnable_avg_sum = slice;
+	p->se.avg.runnable_avg_period = slice;
+	p->se.avg.last_runnable_update = rq_of(cfs_rq)->clock;
+	__update_entity_load_avg_contrib(&p->se);
+	__update_entity_util_avg_contrib(&p->se);
+}
+
+/*
+ * Utilization of the cpu as seen by cpufreq: the runnable fraction of the
+ * entities queued at the root, which can exceed SCHED_POWER_SCALE when
+ * several of them compete for the cpu.
+ */
+static inline unsigned long cpu_util(struct rq *rq)
+{
+	return rq->cfs.runnable_util_avg;
+}
+#else
+static inline void update_entity_load_avg(struct sched_entity *se)
+{
+}
+
+static inline void enqueue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se)
+{
+}
+
+static inline void dequeue_entity_load_avg(struct cfs_rq *cfs_rq,
+					   struct sched_entity *se)
+{
+}
+
+static inline void init_task_runnable_average(struct cfs_rq *cfs_rq,
+					      struct task_struct *p)
+{
+}
+
+static inline unsigned long cpu_util(struct rq *rq)
+{
+	return rq->cfs.h_nr_running ? SCHED_POWER_SCALE : 0;
+}
+#endif
+
 static void enqueue_sleeper(struct cfs_rq *cfs_rq, struct sched_entity *se)
 {
 #ifdef CONFIG_SCHEDSTATS
@@ -905,6 +1149,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 	check_spread(cfs_rq, se);
 	if (se != cfs_rq->curr)
 		__enqueue_entity(cfs_rq, se);
+	enqueue_entity_load_avg(cfs_rq, se);
 	se->on_rq = 1;
 
 	if (cfs_rq->nr_running == 1) {
@@ -983,6 +1228,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 
 	if (se != cfs_rq->curr)
 		__dequeue_entity(cfs_rq, se);
+	dequeue_entity_load_avg(cfs_rq, se);
 	se->on_rq = 0;
 	update_cfs_load(cfs_rq, 0);
 	account_entity_dequeue(cfs_rq, se);
@@ -1032,6 +1278,7 @@ set_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
 	if (se->on_rq) {
 		update_stats_wait_end(cfs_rq, se);
 		__dequeue_entity(cfs_rq, se);
+		update_entity_load_avg(se);
 	}
 
 	update_stats_curr_start(cfs_rq, se);
@@ -1121,6 +1368,7 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 		update_stats_wait_start(cfs_rq, prev);
 		
 		__enqueue_entity(cfs_rq, prev);
+		update_entity_load_avg(prev);
 	}
 	cfs_rq->curr = NULL;
 }
@@ -1130,6 +1378,7 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 {
 	update_curr(cfs_rq);
 
+	update_entity_load_avg(curr);
 	update_entity_shares_tick(cfs_rq);
 
 #ifdef CONFIG_SCHED_HRTICK
@@ -1877,11 +2126,13 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 
 		update_cfs_load(cfs_rq, 0);
 		update_cfs_shares(cfs_rq);
+		update_entity_load_avg(se);
 	}
 
 	if (!se)
 		inc_nr_running(rq);
 	hrtick_update(rq);
+	cpufreq_update_util(rq, cpu_util(rq), SCHED_POWER_SCALE);
 }
 
 static void set_next_buddy(struct sched_entity *se);
@@ -1921,17 +2172,34 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 
 		update_cfs_load(cfs_rq, 0);
 		update_cfs_shares(cfs_rq);
+		update_entity_load_avg(se);
 	}
 
 	if (!se)
 		dec_nr_running(rq);
 	hrtick_update(rq);
+	cpufreq_update_util(rq, cpu_util(rq), SCHED_POWER_SCALE);
 }
 
 #ifdef CONFIG_SMP
 static unsigned long weighted_cpuload(const int cpu)
 {
-	return cpu_rq(cpu)->load.weight;
+	return rq_runnable_load(cpu_rq(cpu));
+}
+
+/* load of se, in the same unit as weighted_cpuload() */
+static inline unsigned long entity_load(struct sched_entity *se)
+{
+	if (sched_feat(RUNNABLE_AVG))
+		return se->avg.load_avg_contrib;
+	return se->load.weight;
+}
+
+static inline unsigned long cfs_rq_load(struct cfs_rq *cfs_rq)
+{
+	if (sched_feat(RUNNABLE_AVG))
+		return cfs_rq->runnable_load_avg;
+	return cfs_rq->load.weight;
 }
 
 static unsigned long source_load(int cpu, int type)
@@ -1967,7 +2235,7 @@ static unsigned long cpu_avg_load_per_task(int cpu)
 	unsigned long nr_running = ACCESS_ONCE(rq->nr_running);
 
 	if (nr_running)
-		return rq->load.weight / nr_running;
+		return weighted_cpuload(cpu) / nr_running;
 
 	return 0;
 }
@@ -2053,14 +2321,14 @@ static int wake_affine(struct sched_domain *sd, struct task_struct *p, int sync)
 
 	if (sync) {
 		tg = task_group(current);
-		weight = current->se.load.weight;
+		weight = entity_load(&current->se);
 
 		this_load += effective_load(tg, this_cpu, -weight, -weight);
 		load += effective_load(tg, prev_cpu, 0, -weight);
 	}
 
 	tg = task_group(p);
-	weight = p->se.load.weight;
+	weight = entity_load(&p->se);
 
 	if (this_load > 0) {
 		s64 this_eff_load, prev_eff_load;
@@ -2720,11 +2988,11 @@ static int tg_load_down(struct task_group *tg, void *data)
 	long cpu = (long)data;
 
 	if (!tg->parent) {
-		load = cpu_rq(cpu)->load.weight;
+		load = weighted_cpuload(cpu);
 	} else {
 		load = tg->parent->cfs_rq[cpu]->h_load;
-		load *= tg->se[cpu]->load.weight;
-		load /= tg->parent->cfs_rq[cpu]->load.weight + 1;
+		load *= entity_load(tg->se[cpu]);
+		load /= cfs_rq_load(tg->parent->cfs_rq[cpu]) + 1;
 	}
 
 	tg->cfs_rq[cpu]->h_load = load;
@@ -2744,8 +3012,8 @@ static unsigned long task_h_load(struct task_struct *p)
 	struct cfs_rq *cfs_rq = task_cfs_rq(p);
 	unsigned long load;
 
-	load = p->se.load.weight;
-	load = div_u64(load * cfs_rq->h_load, cfs_rq->load.weight + 1);
+	load = entity_load(&p->se);
+	load = div_u64(load * cfs_rq->h_load, cfs_rq_load(cfs_rq) + 1);
 
 	return load;
 }
@@ -2760,7 +3028,7 @@ static inline void update_h_load(long cpu)
 
 static unsigned long task_h_load(struct task_struct *p)
 {
-	return p->se.load.weight;
+	return entity_load(&p->se);
 }
 #endif
 
@@ -4027,6 +4295,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	cpufreq_update_util(rq, cpu_util(rq), SCHED_POWER_SCALE);
 }
 
 static void task_fork_fair(struct task_struct *p)
@@ -4067,6 +4337,8 @@ static void task_fork_fair(struct task_struct *p)
 
 	se->vruntime -= cfs_rq->min_vruntime;
 
+	init_task_runnable_average(cfs_rq, p);
+
 	raw_spin_unlock_irqrestore(&rq->lock, flags);
 }
 
@@ -1672,6 +1672,8 @@ static void task_tick_rt(struct rq *rq, struct task_struct *p, int queued)
 
 	watchdog(rq, p);
 
+	cpufreq_update_util(rq, ULONG_MAX, SCHED_POWER_SCALE);
+
 	if (p->policy != SCHED_RR)
 		return;
 
@@ -177,6 +177,11 @@ struct cfs_rq {
 	unsigned int nr_spread_over;
 #endif
 
+#ifdef CONFIG_SMP
+	unsigned long runnable_load_avg;
+	unsigned long runnable_util_avg;
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	
 
@@ -520,6 +525,35 @@ extern struct static_key sched_feat_keys[__SCHED_FEAT_NR];
 #define sched_feat(x) (sysctl_sched_features & (1UL << __SCHED_FEAT_##x))
 #endif 
 
+static inline unsigned long rq_runnable_load(struct rq *rq)
+{
+#ifdef CONFIG_SMP
+	if (sched_feat(RUNNABLE_AVG))
+		return rq->cfs.runnable_load_avg;
+#endif
+	return rq->load.weight;
+}
+
+#ifdef CONFIG_CPU_FREQ
+DECLARE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+static inline void cpufreq_update_util(struct rq *rq, unsigned long util,
+				       unsigned long max)
+{
+	struct update_util_data *data;
+
+	data = rcu_dereference_sched(per_cpu(cpufreq_update_util_data,
+					     cpu_of(rq)));
+	if (data)
+		data->func(data, rq->clock, util, max);
+}
+#else
+static inline void cpufreq_update_util(struct rq *rq, unsigned long util,
+				       unsigned long max)
+{
+}
+#endif
+
 static inline u64 global_rt_period(void)
 {
 	return (u64)sysctl_sched_rt_period * NSEC_PER_USEC;
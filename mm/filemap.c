@@ -763,6 +763,8 @@ find_page:
 			page = find_get_page(mapping, index);
 			if (unlikely(page == NULL))
 				goto no_cached_page;
+		} else {
+			ra_mark_hit(ra, index);
 		}
 		if (PageReadahead(page)) {
 			page_cache_async_readahead(mapping,
@@ -1137,10 +1139,16 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 	if (ra->mmap_miss < MMAP_LOTSAMISS * 10)
 		ra->mmap_miss++;
 
+	if (ra_detect_stride(ra, offset, 1)) {
+		ra_stride_readahead(mapping, ra, file, offset, 1);
+		return;
+	}
+
 	if (ra->mmap_miss > MMAP_LOTSAMISS)
 		return;
 
-	ra_pages = max_sane_readahead(ra->ra_pages);
+	ra_pages = ra_max_pages(ra);
+	ra_new_window(ra, offset, 1);
 	ra->start = max_t(long, 0, offset - ra_pages / 2);
 	ra->size = ra_pages;
 	ra->async_size = ra_pages / 4;
@@ -1160,6 +1168,7 @@ static void do_async_mmap_readahead(struct vm_area_struct *vma,
 		return;
 	if (ra->mmap_miss > 0)
 		ra->mmap_miss--;
+	ra_mark_hit(ra, offset);
 	if (PageReadahead(page))
 		page_cache_async_readahead(mapping, ra, file,
 					   page, offset, ra->ra_pages);
@@ -239,6 +239,16 @@ static inline void mminit_validate_memmodel_limits(unsigned long *start_pfn,
 }
 #endif 
 
+extern unsigned long ra_max_pages(struct file_ra_state *ra);
+extern void ra_new_window(struct file_ra_state *ra, pgoff_t offset,
+			  unsigned long size);
+extern bool ra_detect_stride(struct file_ra_state *ra, pgoff_t offset,
+			     unsigned long req_size);
+extern unsigned long ra_stride_readahead(struct address_space *mapping,
+					 struct file_ra_state *ra,
+					 struct file *filp, pgoff_t offset,
+					 unsigned long req_size);
+
 #define ZONE_RECLAIM_NOSCAN	-2
 #define ZONE_RECLAIM_FULL	-1
 #define ZONE_RECLAIM_SOME	0
@@ -17,12 +17,31 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
+#include <linux/vmstat.h>
+
+#include "internal.h"
+
+/* each window that goes unused halves the next ones, down to 1/8 */
+#define RA_MAX_SHIFT		3
+/* equal strides between misses before reading ahead along them */
+#define RA_STRIDE_CONFIRM	2
+/* max number of strides read ahead at once */
+#define RA_STRIDE_MAX		8
+/* max distance between misses taken for a stride, in pages */
+#define RA_STRIDE_MAX_GAP	4096
 
 void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 {
 	ra->ra_pages = mapping->backing_dev_info->ra_pages;
 	ra->prev_pos = -1;
+	ra->demand = 0;
+	ra->demand_size = 0;
+	ra->last_miss = 0;
+	ra->stride = 0;
+	ra->stride_count = 0;
+	ra->shift = 0;
+	ra->hit = 0;
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
 
@@ -197,6 +216,99 @@ unsigned long max_sane_readahead(unsigned long nr)
 		+ node_page_state(numa_node_id(), NR_FREE_PAGES)) / 2);
 }
 
+unsigned long ra_max_pages(struct file_ra_state *ra)
+{
+	return max(max_sane_readahead(ra->ra_pages) >> ra->shift, 1UL);
+}
+
+/*
+ * Called before the window of @ra is replaced by one read for @size pages
+ * at @offset. The old window was a hit if any page it read ahead, beyond
+ * the ones it was read for, has been accessed since. Misses shrink the
+ * following windows and hits let them grow back.
+ */
+void ra_new_window(struct file_ra_state *ra, pgoff_t offset,
+		   unsigned long size)
+{
+	if (ra->size) {
+		if (ra->hit) {
+			count_vm_event(READAHEAD_HIT);
+			if (ra->shift)
+				ra->shift--;
+		} else {
+			count_vm_event(READAHEAD_MISS);
+			if (ra->shift < RA_MAX_SHIFT)
+				ra->shift++;
+		}
+	}
+
+	ra->hit = 0;
+	ra->demand = offset;
+	ra->demand_size = size;
+}
+
+/*
+ * Feed a random miss at @offset to the stride detector, and tell if the
+ * misses have been evenly spaced for long enough to read ahead along them.
+ */
+bool ra_detect_stride(struct file_ra_state *ra, pgoff_t offset,
+		      unsigned long req_size)
+{
+	long delta = (long)(offset - ra->last_miss);
+
+	ra->last_miss = offset;
+
+	if (abs(delta) > RA_STRIDE_MAX_GAP || abs(delta) <= req_size) {
+		ra->stride = 0;
+		ra->stride_count = 0;
+	} else if (delta == ra->stride) {
+		if (ra->stride_count < RA_STRIDE_CONFIRM)
+			ra->stride_count++;
+	} else {
+		ra->stride = delta;
+		ra->stride_count = 0;
+	}
+
+	return ra->stride_count >= RA_STRIDE_CONFIRM;
+}
+
+/*
+ * Read @req_size pages at @offset and at the next strides, as many as fit
+ * in the current window size, and make them the window of @ra.
+ */
+unsigned long ra_stride_readahead(struct address_space *mapping,
+				  struct file_ra_state *ra, struct file *filp,
+				  pgoff_t offset, unsigned long req_size)
+{
+	unsigned long nr = clamp_t(unsigned long,
+				   ra_max_pages(ra) / req_size, 1, RA_STRIDE_MAX);
+	long stride = ra->stride;
+	pgoff_t index = offset;
+	struct blk_plug plug;
+	unsigned long ret;
+
+	ra_new_window(ra, offset, req_size);
+
+	blk_start_plug(&plug);
+	ret = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	while (nr--) {
+		if (stride < 0 && index < -stride)
+			break;
+		index += stride;
+		ret += __do_page_cache_readahead(mapping, filp, index,
+						 req_size, 0);
+	}
+	blk_finish_plug(&plug);
+
+	ra->start = min(offset, index);
+	ra->size = abs((long)(index - offset)) + req_size;
+	ra->async_size = 0;
+	ra->last_miss = index;
+
+	count_vm_event(READAHEAD_STRIDE);
+	return ret;
+}
+
 unsigned long ra_submit(struct file_ra_state *ra,
 		       struct address_space *mapping, struct file *filp)
 {
@@ -266,6 +378,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_new_window(ra, offset, req_size);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -279,13 +392,14 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max = ra_max_pages(ra);
 
 	if (!offset)
 		goto initial_readahead;
 
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		ra_new_window(ra, offset, req_size);
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -302,6 +416,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_new_window(ra, offset, req_size);
 		ra->start = start;
 		ra->size = start - offset;	
 		ra->size += req_size;
@@ -319,9 +434,13 @@ ondemand_readahead(struct address_space *mapping,
 	if (try_context_readahead(mapping, ra, offset, req_size, max))
 		goto readit;
 
+	if (ra_detect_stride(ra, offset, req_size))
+		return ra_stride_readahead(mapping, ra, filp, offset, req_size);
+
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	ra_new_window(ra, offset, req_size);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -368,6 +487,7 @@ page_cache_async_readahead(struct address_space *mapping,
 		return;
 
 	ClearPageReadahead(page);
+	ra_mark_hit(ra, offset);
 
 	if (bdi_read_congested(mapping->backing_dev_info))
 		return;
@@ -581,6 +581,9 @@ const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+	"readahead_hit",
+	"readahead_miss",
+	"readahead_stride",
 
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
@@ -0,0 +1,480 @@
+/*
+ * binder_bench:
+ *
+ * Measures binder round-trip latency with 1 to 4 client/server pairs
+ * running at the same time, to see how transactions scale across cores.
+ *
+ * The benchmark registers itself as the binder context manager, so it
+ * must run as root on a system without servicemanager (e.g. from
+ * recovery, or with servicemanager stopped). Each server hands its node
+ * to the context manager, each client looks up one server and then
+ * times synchronous transactions to it.
+ *
+ * Usage: binder_bench [iterations]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	4
+
+enum {
+	CODE_REGISTER = 1,
+	CODE_LOOKUP,
+	CODE_PING,
+};
+
+struct bench_binder {
+	int fd;
+	void *map;
+};
+
+struct register_msg {
+	struct flat_binder_object obj;
+	uint32_t index;
+};
+
+static int iterations = 20000;
+
+static int bb_open(struct bench_binder *bb)
+{
+	bb->fd = open("/dev/binder", O_RDWR);
+	if (bb->fd < 0) {
+		perror("open /dev/binder");
+		return -1;
+	}
+	bb->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, bb->fd, 0);
+	if (bb->map == MAP_FAILED) {
+		perror("mmap");
+		close(bb->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static int bb_write(struct bench_binder *bb, void *data, size_t len)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)data;
+	if (ioctl(bb->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		perror("BINDER_WRITE_READ write");
+		return -1;
+	}
+	return 0;
+}
+
+static int bb_acquire(struct bench_binder *bb, uint32_t handle)
+{
+	uint32_t cmd[2] = { BC_ACQUIRE, handle };
+
+	return bb_write(bb, cmd, sizeof(cmd));
+}
+
+/* Acknowledge the refcount commands the driver sends for our own node */
+static int bb_node_cmd(struct bench_binder *bb, uint32_t cmd, void *ptr)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_ptr_cookie pc;
+	} __attribute__((packed)) done;
+
+	if (cmd != BR_INCREFS && cmd != BR_ACQUIRE)
+		return 0;
+	done.cmd = cmd == BR_INCREFS ? BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+	memcpy(&done.pc, ptr, sizeof(done.pc));
+	return bb_write(bb, &done, sizeof(done));
+}
+
+/*
+ * Read until a BR_TRANSACTION or BR_REPLY arrives and copy it to *tr.
+ * Returns the command, or 0 on error.
+ */
+static uint32_t bb_read_txn(struct bench_binder *bb,
+		       struct binder_transaction_data *tr)
+{
+	uint32_t readbuf[64];
+	struct binder_write_read bwr;
+
+	for (;;) {
+		char *ptr, *end;
+
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_size = sizeof(readbuf);
+		bwr.read_buffer = (unsigned long)readbuf;
+		if (ioctl(bb->fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("BINDER_WRITE_READ read");
+			return 0;
+		}
+		ptr = (char *)readbuf;
+		end = ptr + bwr.read_consumed;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(uint32_t);
+			switch (cmd) {
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(tr, ptr, sizeof(*tr));
+				/* at most one transaction is returned per read */
+				return cmd;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				fprintf(stderr, "transaction failed (%x)\n", cmd);
+				return 0;
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				if (bb_node_cmd(bb, cmd, ptr))
+					return 0;
+				break;
+			default:
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+}
+
+static int bb_free_buffer(struct bench_binder *bb, const void *data)
+{
+	struct {
+		uint32_t cmd;
+		const void *data;
+	} __attribute__((packed)) cmd = { BC_FREE_BUFFER, data };
+
+	return bb_write(bb, &cmd, sizeof(cmd));
+}
+
+static int bb_call(struct bench_binder *bb, uint32_t handle, uint32_t code,
+		   void *data, size_t size, size_t *offsets, size_t nr_offsets,
+		   struct binder_transaction_data *reply)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data tr;
+	} __attribute__((packed)) txn;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.cmd = BC_TRANSACTION;
+	txn.tr.target.handle = handle;
+	txn.tr.code = code;
+	txn.tr.data_size = size;
+	txn.tr.offsets_size = nr_offsets * sizeof(size_t);
+	txn.tr.data.ptr.buffer = data;
+	txn.tr.data.ptr.offsets = offsets;
+	if (bb_write(bb, &txn, sizeof(txn)))
+		return -1;
+	if (bb_read_txn(bb, reply) != BR_REPLY)
+		return -1;
+	return 0;
+}
+
+/*
+ * Serve transactions forever. The handler fills in the reply data, the
+ * request buffer is freed together with sending the reply.
+ */
+static void bb_loop(struct bench_binder *bb,
+		    void (*handler)(struct bench_binder *bb,
+				    struct binder_transaction_data *tr,
+				    struct binder_transaction_data *reply))
+{
+	struct binder_transaction_data tr, reply;
+	struct {
+		uint32_t free_cmd;
+		const void *free_data;
+		uint32_t reply_cmd;
+		struct binder_transaction_data reply;
+	} __attribute__((packed)) out;
+	uint32_t enter = BC_ENTER_LOOPER;
+
+	bb_write(bb, &enter, sizeof(enter));
+	for (;;) {
+		if (bb_read_txn(bb, &tr) != BR_TRANSACTION)
+			exit(1);
+		memset(&reply, 0, sizeof(reply));
+		handler(bb, &tr, &reply);
+		out.free_cmd = BC_FREE_BUFFER;
+		out.free_data = tr.data.ptr.buffer;
+		out.reply_cmd = BC_REPLY;
+		out.reply = reply;
+		if (bb_write(bb, &out, sizeof(out)))
+			exit(1);
+	}
+}
+
+static uint32_t registry[MAX_PAIRS];
+static struct flat_binder_object lookup_obj;
+static size_t lookup_offset;
+
+static void registry_handler(struct bench_binder *bb,
+			     struct binder_transaction_data *tr,
+			     struct binder_transaction_data *reply)
+{
+	if (tr->code == CODE_REGISTER &&
+	    tr->data_size == sizeof(struct register_msg)) {
+		const struct register_msg *msg = tr->data.ptr.buffer;
+
+		if (msg->index < MAX_PAIRS &&
+		    msg->obj.type == BINDER_TYPE_HANDLE) {
+			/* keep the ref once the request buffer is freed */
+			bb_acquire(bb, msg->obj.handle);
+			registry[msg->index] = msg->obj.handle;
+		}
+	} else if (tr->code == CODE_LOOKUP &&
+		   tr->data_size == sizeof(uint32_t)) {
+		uint32_t index = *(const uint32_t *)tr->data.ptr.buffer;
+
+		if (index < MAX_PAIRS && registry[index]) {
+			memset(&lookup_obj, 0, sizeof(lookup_obj));
+			lookup_obj.type = BINDER_TYPE_HANDLE;
+			lookup_obj.handle = registry[index];
+			lookup_offset = 0;
+			reply->data_size = sizeof(lookup_obj);
+			reply->offsets_size = sizeof(size_t);
+			reply->data.ptr.buffer = &lookup_obj;
+			reply->data.ptr.offsets = &lookup_offset;
+		}
+	}
+}
+
+static uint32_t pong;
+
+static void server_handler(struct bench_binder *bb,
+			   struct binder_transaction_data *tr,
+			   struct binder_transaction_data *reply)
+{
+	(void)bb;
+	if (tr->data_size == sizeof(pong))
+		pong = *(const uint32_t *)tr->data.ptr.buffer;
+	reply->data_size = sizeof(pong);
+	reply->data.ptr.buffer = &pong;
+}
+
+static void run_registry(int ready_fd)
+{
+	struct bench_binder bb;
+	char c = 0;
+
+	if (bb_open(&bb))
+		exit(1);
+	if (ioctl(bb.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+	if (write(ready_fd, &c, 1) != 1)
+		exit(1);
+	close(ready_fd);
+	bb_loop(&bb, registry_handler);
+}
+
+static void run_server(uint32_t index, int ready_fd)
+{
+	struct bench_binder bb;
+	struct binder_transaction_data reply;
+	struct register_msg msg;
+	size_t offset = 0;
+	char c = 0;
+
+	if (bb_open(&bb))
+		exit(1);
+	memset(&msg, 0, sizeof(msg));
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.binder = &bb;
+	msg.obj.cookie = &bb;
+	msg.index = index;
+	if (bb_call(&bb, 0, CODE_REGISTER, &msg, sizeof(msg),
+		    &offset, 1, &reply))
+		exit(1);
+	bb_free_buffer(&bb, reply.data.ptr.buffer);
+	if (write(ready_fd, &c, 1) != 1)
+		exit(1);
+	close(ready_fd);
+	bb_loop(&bb, server_handler);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void run_client(uint32_t index, int start_fd, int result_fd)
+{
+	struct bench_binder bb;
+	struct binder_transaction_data reply;
+	const struct flat_binder_object *obj;
+	uint32_t handle, seq;
+	uint64_t start, total, min = ~0ULL, max = 0;
+	uint64_t result[3];
+	char c;
+	int i;
+
+	if (bb_open(&bb))
+		exit(1);
+	if (bb_call(&bb, 0, CODE_LOOKUP, &index, sizeof(index),
+		    NULL, 0, &reply))
+		exit(1);
+	if (reply.data_size != sizeof(*obj)) {
+		fprintf(stderr, "client %u: server not registered\n", index);
+		exit(1);
+	}
+	obj = reply.data.ptr.buffer;
+	handle = obj->handle;
+	bb_acquire(&bb, handle);
+	bb_free_buffer(&bb, reply.data.ptr.buffer);
+
+	/* all clients start together */
+	if (read(start_fd, &c, 1) != 1)
+		exit(1);
+
+	total = 0;
+	for (i = 0; i < iterations; i++) {
+		uint64_t t;
+
+		seq = i;
+		start = now_ns();
+		if (bb_call(&bb, handle, CODE_PING, &seq, sizeof(seq),
+			    NULL, 0, &reply))
+			exit(1);
+		bb_free_buffer(&bb, reply.data.ptr.buffer);
+		t = now_ns() - start;
+		total += t;
+		if (t < min)
+			min = t;
+		if (t > max)
+			max = t;
+	}
+	result[0] = total;
+	result[1] = min;
+	result[2] = max;
+	if (write(result_fd, result, sizeof(result)) != sizeof(result))
+		exit(1);
+	exit(0);
+}
+
+static int run_pairs(int pairs)
+{
+	pid_t servers[MAX_PAIRS], clients[MAX_PAIRS];
+	int ready[2], start[2], results[2];
+	uint64_t total = 0, min = ~0ULL, max = 0;
+	uint64_t wall;
+	char c = 0;
+	int i;
+
+	if (pipe(ready) || pipe(start) || pipe(results)) {
+		perror("pipe");
+		return -1;
+	}
+	for (i = 0; i < pairs; i++) {
+		servers[i] = fork();
+		if (servers[i] == 0)
+			run_server(i, ready[1]);
+	}
+	for (i = 0; i < pairs; i++) {
+		if (read(ready[0], &c, 1) != 1)
+			return -1;
+	}
+	for (i = 0; i < pairs; i++) {
+		clients[i] = fork();
+		if (clients[i] == 0)
+			run_client(i, start[0], results[1]);
+	}
+
+	wall = now_ns();
+	for (i = 0; i < pairs; i++) {
+		if (write(start[1], &c, 1) != 1)
+			return -1;
+	}
+	for (i = 0; i < pairs; i++) {
+		uint64_t result[3];
+
+		if (read(results[0], result, sizeof(result)) != sizeof(result)) {
+			fprintf(stderr, "client failed\n");
+			return -1;
+		}
+		total += result[0];
+		if (result[1] < min)
+			min = result[1];
+		if (result[2] > max)
+			max = result[2];
+	}
+	wall = now_ns() - wall;
+
+	for (i = 0; i < pairs; i++) {
+		waitpid(clients[i], NULL, 0);
+		kill(servers[i], SIGKILL);
+		waitpid(servers[i], NULL, 0);
+	}
+	close(ready[0]);
+	close(ready[1]);
+	close(start[0]);
+	close(start[1]);
+	close(results[0]);
+	close(results[1]);
+
+	printf("%d pair(s): avg %llu ns  min %llu ns  max %llu ns  "
+	       "%llu transactions/s\n", pairs,
+	       (unsigned long long)(total / ((uint64_t)iterations * pairs)),
+	       (unsigned long long)min, (unsigned long long)max,
+	       (unsigned long long)((uint64_t)iterations * pairs *
+				    1000000000ULL / wall));
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	pid_t registry_pid;
+	int ready[2];
+	int pairs, ret = 0;
+	char c;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	if (pipe(ready)) {
+		perror("pipe");
+		return 1;
+	}
+	registry_pid = fork();
+	if (registry_pid == 0)
+		run_registry(ready[1]);
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		waitpid(registry_pid, NULL, 0);
+		return 1;
+	}
+
+	for (pairs = 1; pairs <= MAX_PAIRS; pairs++) {
+		ret = run_pairs(pairs);
+		if (ret)
+			break;
+	}
+
+	kill(registry_pid, SIGKILL);
+	waitpid(registry_pid, NULL, 0);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * binder_latency:
+ *
+ * Decodes the binary debugfs binder/latency file and prints the queue
+ * and reply round trip histograms of every process and thread that has
+ * seen any transactions.
+ *
+ * Usage: binder_latency [file]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "binder.h"
+
+#define DEFAULT_FILE	"/sys/kernel/debug/binder/latency"
+
+static void print_hist(const char *name, const uint32_t *hist)
+{
+	unsigned long long total = 0;
+	int i, last = -1;
+
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		total += hist[i];
+		if (hist[i])
+			last = i;
+	}
+	if (!total)
+		return;
+	printf("  %s: %llu\n", name, total);
+	for (i = 0; i <= last; i++) {
+		if (!hist[i])
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			printf("    >=%7luus %u\n", 1UL << (i - 1), hist[i]);
+		else
+			printf("    <%8luus %u\n", 1UL << i, hist[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : DEFAULT_FILE;
+	struct binder_latency_header hdr;
+	struct binder_latency_record rec;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    hdr.version != BINDER_LATENCY_VERSION ||
+	    hdr.buckets != BINDER_LATENCY_BUCKETS ||
+	    hdr.record_size != sizeof(rec)) {
+		fprintf(stderr, "%s: unsupported format\n", path);
+		return 1;
+	}
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		uint32_t zero[BINDER_LATENCY_BUCKETS] = { 0 };
+
+		if (!memcmp(rec.queue, zero, sizeof(zero)) &&
+		    !memcmp(rec.reply, zero, sizeof(zero)))
+			continue;
+		if (rec.tid)
+			printf("thread %d:%d\n", rec.pid, rec.tid);
+		else
+			printf("proc %d\n", rec.pid);
+		print_hist("queue", rec.queue);
+		print_hist("reply", rec.reply);
+	}
+	fclose(f);
+	return 0;
+}
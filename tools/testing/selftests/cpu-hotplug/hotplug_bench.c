@@ -0,0 +1,206 @@
+/*
+ * hotplug_bench:
+ *
+ * Takes a cpu offline and back online through sysfs a number of times
+ * and prints percentiles of how long each write took. When a third cpu
+ * is available, a thread spinning on it records the longest gap it saw
+ * in its own progress during each offline, which is the stall the rest
+ * of the system sees while the machine is stopped.
+ *
+ * Needs root and a kernel with CONFIG_HOTPLUG_CPU; under QEMU boot with
+ * at least -smp 3 to get the stall numbers.
+ *
+ * Usage: hotplug_bench [cpu] [cycles]
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CPUS	64
+
+static int cycles = 1000;
+static int target = -1;
+static int watch_cpu = -1;
+
+static volatile int watch_reset;
+static volatile int watch_stop;
+static volatile double watch_max_gap;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void *watcher(void *arg)
+{
+	double last, t, max = 0;
+
+	(void)arg;
+	if (pin(watch_cpu)) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+
+	last = now();
+	while (!watch_stop) {
+		t = now();
+		if (watch_reset) {
+			max = 0;
+			watch_max_gap = 0;
+			watch_reset = 0;
+		} else if (t - last > max) {
+			max = t - last;
+			watch_max_gap = max;
+		}
+		last = t;
+	}
+	return NULL;
+}
+
+static int cpu_online(int cpu)
+{
+	char path[64], c;
+	int fd, ret;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/online",
+		 cpu);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return cpu == 0;
+	ret = read(fd, &c, 1) == 1 && c == '1';
+	close(fd);
+	return ret;
+}
+
+static int set_online(int fd, int online, double *usecs)
+{
+	double start = now();
+
+	if (pwrite(fd, online ? "1" : "0", 1, 0) != 1)
+		return -1;
+	*usecs = now() - start;
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, double *v, int n)
+{
+	qsort(v, n, sizeof(*v), cmp_double);
+	printf("%-8s %10.0f %10.0f %10.0f %10.0f %10.0f\n", name, v[0],
+	       v[n / 2], v[n * 90 / 100], v[n * 99 / 100], v[n - 1]);
+}
+
+int main(int argc, char **argv)
+{
+	double *off, *on, *stall;
+	pthread_t thread;
+	char path[64];
+	int fd, i, cpu, nr_cpus;
+
+	if (argc > 1)
+		target = atoi(argv[1]);
+	if (argc > 2)
+		cycles = atoi(argv[2]);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nr_cpus > MAX_CPUS)
+		nr_cpus = MAX_CPUS;
+	for (cpu = nr_cpus - 1; target < 0 && cpu > 0; cpu--)
+		if (cpu_online(cpu))
+			target = cpu;
+	if (target <= 0 || target >= nr_cpus || cycles <= 0) {
+		fprintf(stderr, "usage: %s [cpu] [cycles]\n", argv[0]);
+		return 1;
+	}
+	for (cpu = 1; cpu < nr_cpus; cpu++)
+		if (cpu != target && cpu_online(cpu)) {
+			watch_cpu = cpu;
+			break;
+		}
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/online",
+		 target);
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	off = calloc(cycles, sizeof(*off));
+	on = calloc(cycles, sizeof(*on));
+	stall = calloc(cycles, sizeof(*stall));
+	if (!off || !on || !stall) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (pin(0)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+	if (watch_cpu > 0 &&
+	    pthread_create(&thread, NULL, watcher, NULL)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	for (i = 0; i < cycles; i++) {
+		if (watch_cpu > 0) {
+			watch_reset = 1;
+			while (watch_reset)
+				sched_yield();
+		}
+		if (set_online(fd, 0, &off[i])) {
+			perror("offline");
+			return 1;
+		}
+		stall[i] = watch_max_gap;
+		if (set_online(fd, 1, &on[i])) {
+			perror("online");
+			return 1;
+		}
+	}
+
+	if (watch_cpu > 0) {
+		watch_stop = 1;
+		pthread_join(thread, NULL);
+	}
+	close(fd);
+
+	printf("cpu%d: %d offline/online cycles, usecs\n", target, cycles);
+	printf("%-8s %10s %10s %10s %10s %10s\n", "", "min", "p50", "p90",
+	       "p99", "max");
+	report("offline", off, cycles);
+	report("online", on, cycles);
+	if (watch_cpu > 0)
+		report("stall", stall, cycles);
+	else
+		printf("stall: needs a third cpu, skipped\n");
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# Measure dm-crypt throughput on a ram disk, once with the default
+# behaviour (large bios split across all online CPUs, writes sorted by a
+# dmcrypt_write thread) and once with same_cpu_crypt and
+# submit_from_crypt_cpus, which is how dm-crypt worked before.
+#
+# The ram disk comes from brd (/dev/ram0) or, if that is missing, from a
+# loop device on a tmpfs file. Needs root and dmsetup.
+#
+# Usage: crypt_bench.sh [size_mb] [block_size]
+
+SIZE_MB=${1:-256}
+BS=${2:-1M}
+NAME=crypt_bench
+CIPHER=aes-cbc-essiv:sha256
+KEY=0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef
+
+if ! which dmsetup > /dev/null 2>&1; then
+	echo "dm-crypt: dmsetup not found, skipping"
+	exit 0
+fi
+
+loop=
+img=
+cleanup()
+{
+	dmsetup remove $NAME 2> /dev/null
+	[ -n "$loop" ] && losetup -d $loop
+	[ -n "$img" ] && rm -f $img
+}
+trap cleanup EXIT
+
+modprobe brd rd_size=$((SIZE_MB * 1024)) 2> /dev/null
+if [ -b /dev/ram0 ] &&
+   [ $(blockdev --getsize64 /dev/ram0) -ge $((SIZE_MB << 20)) ]; then
+	dev=/dev/ram0
+else
+	img=/dev/shm/$NAME.img
+	dd if=/dev/zero of=$img bs=1M count=$SIZE_MB 2> /dev/null || exit 1
+	loop=$(losetup -f --show $img) || exit 1
+	dev=$loop
+fi
+sectors=$((SIZE_MB * 2048))
+count=$((SIZE_MB * 1024 * 1024 / $(numfmt --from=iec $BS)))
+
+# dd's last line ends in the rate, e.g. "..., 1.2 s, 215 MB/s"
+rate()
+{
+	tail -n 1 | sed 's/.*, //'
+}
+
+echo "$dev, $SIZE_MB MiB, $BS blocks, $(nproc) cpus"
+for opts in "2 same_cpu_crypt submit_from_crypt_cpus" ""; do
+	table="0 $sectors crypt $CIPHER $KEY 0 $dev 0 $opts"
+	dmsetup create $NAME --table "$table" || exit 1
+	sync
+	echo 3 > /proc/sys/vm/drop_caches
+
+	w=$(dd if=/dev/zero of=/dev/mapper/$NAME bs=$BS count=$count \
+		oflag=direct 2>&1 | rate)
+	r=$(dd if=/dev/mapper/$NAME of=/dev/null bs=$BS count=$count \
+		iflag=direct 2>&1 | rate)
+	printf "%-40s write %12s read %12s\n" "${opts:-default}" "$w" "$r"
+
+	dmsetup remove $NAME || exit 1
+done
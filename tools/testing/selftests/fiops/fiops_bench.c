@@ -0,0 +1,228 @@
+/*
+ * fiops_bench:
+ *
+ * Runs a number of reader processes against a block device with O_DIRECT
+ * and prints the throughput and read latency of each. Job 0 reads its
+ * part of the device sequentially and the others read theirs at random,
+ * so a scheduler that favours sequential streams shows up as an uneven
+ * split. Each process has its own io context.
+ *
+ * The fairness line is Jain's index of the per-job IOPS, counted only
+ * while all jobs were running: 1.0 is an even split, 1/jobs means one
+ * job got everything. With -s the jobs start that many seconds apart;
+ * the max latency of job 0 then shows whether an ioc that ran alone is
+ * starved once the others join.
+ *
+ * run_bench.sh sets up a scsi_debug ramdisk with a response delay and
+ * compares fiops with and without request batching.
+ *
+ * Usage: fiops_bench [-t secs] [-j jobs] [-s stagger] [-b bs] [-r] <dev>
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_JOBS	64
+
+struct job_result {
+	long ios;
+	long shared_ios;
+	double secs;
+	double p50, p99, max;
+};
+
+static int secs = 10;
+static int jobs = 2;
+static int stagger;
+static int bs = 4096;
+static int all_random;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long long dev_size(int fd)
+{
+	unsigned long long size;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return 0;
+	if (S_ISREG(st.st_mode))
+		return st.st_size;
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		return 0;
+	return size;
+}
+
+static int run_job(const char *dev, int job, double start,
+		   struct job_result *res)
+{
+	unsigned long long size, base, blocks, blk = 0;
+	double t, begin, end, shared, *lat = NULL;
+	long nr = 0, alloc = 0;
+	void *buf;
+	int fd;
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	size = dev_size(fd);
+	blocks = size / jobs / bs;
+	if (!blocks) {
+		fprintf(stderr, "%s: too small\n", dev);
+		return 1;
+	}
+	base = (unsigned long long)job * blocks * bs;
+	if (posix_memalign(&buf, 4096, bs)) {
+		perror("posix_memalign");
+		return 1;
+	}
+	srandom(getpid());
+
+	begin = start + job * stagger * 1e6;
+	shared = start + (jobs - 1) * stagger * 1e6;
+	end = start + secs * 1e6;
+	while (now() < begin)
+		usleep(1000);
+
+	while ((t = now()) < end) {
+		if (all_random || job)
+			blk = random() % blocks;
+		else if (++blk == blocks)
+			blk = 0;
+		if (pread(fd, buf, bs, base + blk * bs) != bs) {
+			perror("pread");
+			return 1;
+		}
+		if (nr == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			lat = realloc(lat, alloc * sizeof(*lat));
+			if (!lat) {
+				perror("realloc");
+				return 1;
+			}
+		}
+		lat[nr++] = now() - t;
+		if (t >= shared)
+			res->shared_ios++;
+	}
+
+	res->ios = nr;
+	res->secs = (end - begin) / 1e6;
+	if (nr) {
+		qsort(lat, nr, sizeof(*lat), cmp_double);
+		res->p50 = lat[nr / 2];
+		res->p99 = lat[nr * 99 / 100];
+		res->max = lat[nr - 1];
+	}
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct job_result *res;
+	double start, sum = 0, sum2 = 0, shared_secs;
+	int opt, i, status, ret = 0;
+
+	while ((opt = getopt(argc, argv, "t:j:s:b:r")) != -1) {
+		switch (opt) {
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 's':
+			stagger = atoi(optarg);
+			break;
+		case 'b':
+			bs = atoi(optarg);
+			break;
+		case 'r':
+			all_random = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || jobs <= 0 || jobs > MAX_JOBS ||
+	    bs <= 0 || bs % 512 || stagger < 0 ||
+	    secs <= (jobs - 1) * stagger)
+		goto usage;
+
+	res = mmap(NULL, jobs * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(res, 0, jobs * sizeof(*res));
+
+	start = now() + 100000;
+	for (i = 0; i < jobs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid)
+			exit(run_job(argv[optind], i, start, &res[i]));
+	}
+	for (i = 0; i < jobs; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			ret = 1;
+	}
+	if (ret)
+		return ret;
+
+	shared_secs = secs - (jobs - 1) * stagger;
+	printf("%s: %d jobs, %d byte reads, %ds, stagger %ds\n",
+	       argv[optind], jobs, bs, secs, stagger);
+	printf("%-4s %-4s %10s %10s %10s %10s %10s\n", "job", "", "iops",
+	       "shared", "p50 us", "p99 us", "max us");
+	for (i = 0; i < jobs; i++) {
+		double iops = res[i].shared_ios / shared_secs;
+
+		printf("%-4d %-4s %10.0f %10.0f %10.0f %10.0f %10.0f\n", i,
+		       all_random || i ? "rand" : "seq",
+		       res[i].ios / res[i].secs, iops, res[i].p50,
+		       res[i].p99, res[i].max);
+		sum += iops;
+		sum2 += iops * iops;
+	}
+	printf("fairness %.3f\n", sum2 ? sum * sum / (jobs * sum2) : 0);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-t secs] [-j jobs] [-s stagger] "
+		"[-b bs] [-r] <dev>\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Compare fiops with request batching (the default batch_requests) and
+# without it (batch_requests=1, which charges every request like fiops
+# did before batching) on a scsi_debug ramdisk. scsi_debug delays each
+# response by DELAY jiffies, which stands in for the device latency.
+#
+# Needs root and scsi_debug built as a module.
+
+DELAY=${DELAY:-1}
+SECS=${SECS:-10}
+
+modprobe scsi_debug dev_size_mb=256 delay=$DELAY || exit 1
+trap 'rmmod scsi_debug' EXIT
+sleep 1
+
+dev=
+for d in /sys/block/sd*; do
+	if grep -qs scsi_debug $d/device/model; then
+		dev=${d##*/}
+		break
+	fi
+done
+if [ -z "$dev" ]; then
+	echo "fiops: no scsi_debug disk found"
+	exit 1
+fi
+if ! grep -qs fiops /sys/block/$dev/queue/scheduler; then
+	echo "fiops: scheduler not available, skipping"
+	exit 0
+fi
+echo fiops > /sys/block/$dev/queue/scheduler
+default=$(cat /sys/block/$dev/queue/iosched/batch_requests)
+
+for batch in 1 $default; do
+	echo $batch > /sys/block/$dev/queue/iosched/batch_requests
+	echo "== batch_requests $batch"
+	./fiops_bench -t $SECS -j 4 /dev/$dev || exit 1
+	./fiops_bench -t $SECS -j 2 -s $((SECS / 2)) /dev/$dev || exit 1
+done
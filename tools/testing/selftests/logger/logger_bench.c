@@ -0,0 +1,121 @@
+/*
+ * logger_bench:
+ *
+ * Measures how many log entries per second 1 to 4 threads can write to
+ * an Android log device at the same time, to see how writers scale
+ * across cores. Entries are laid out the way liblog writes them:
+ * priority, tag and message in one writev().
+ *
+ * Usage: logger_bench [device] [entries per thread]
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define DEFAULT_DEVICE	"/dev/log/main"
+#define MAX_THREADS	4
+
+static const char *device = DEFAULT_DEVICE;
+static int entries = 100000;
+static pthread_barrier_t barrier;
+
+static void *writer(void *arg)
+{
+	static const char tag[] = "logger_bench";
+	char prio = 3;	/* ANDROID_LOG_DEBUG */
+	char msg[64];
+	struct iovec iov[3];
+	long failed = 0;
+	int fd, i;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	snprintf(msg, sizeof(msg), "writer %ld: benchmark entry",
+		 (long)arg);
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void *)tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = strlen(msg) + 1;
+
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < entries; i++) {
+		if (writev(fd, iov, 3) < 0)
+			failed++;
+	}
+	close(fd);
+	return (void *)failed;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(int nr_threads)
+{
+	pthread_t threads[MAX_THREADS];
+	long failed = 0;
+	double start, elapsed;
+	long i;
+
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, writer, (void *)i)) {
+			perror("pthread_create");
+			return -1;
+		}
+	}
+	pthread_barrier_wait(&barrier);
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		void *ret;
+
+		pthread_join(threads[i], &ret);
+		failed += (long)ret;
+	}
+	elapsed = now() - start;
+	pthread_barrier_destroy(&barrier);
+
+	printf("%d thread(s): %.0f entries/s (%d entries in %.3fs)\n",
+	       nr_threads, (double)nr_threads * entries / elapsed,
+	       nr_threads * entries, elapsed);
+	if (failed) {
+		fprintf(stderr, "%ld writes failed\n", failed);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc > 1)
+		device = argv[1];
+	if (argc > 2)
+		entries = atoi(argv[2]);
+	if (entries <= 0) {
+		fprintf(stderr, "usage: %s [device] [entries per thread]\n",
+			argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i <= MAX_THREADS; i++)
+		if (run(i))
+			return 1;
+	return 0;
+}